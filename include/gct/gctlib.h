@@ -79,7 +79,11 @@ typedef struct gct_header_s {
 
   /* This seems to be 0 when the image is upright,
    * and -1 when the image is vertically flipped.
-   * I may be wrong about this */
+   * I may be wrong about this
+   *
+   * Images with -1 are stored bottom-up, the decoder flips them
+   * back while decoding, so its output is always upright. Any
+   * other value is read as upright */
   gct_be32_t orientation;
 
   /* Image data starts at 0x20 in file */
@@ -114,10 +118,405 @@ enum gct_error_e {
   /* Invalid image file */
   gct_ERR_INVALID_IMAGE,
 
+  /* Memory allocation failed */
+  gct_ERR_OUT_OF_MEMORY,
+
+  /* Invalid value in an options struct */
+  gct_ERR_INVALID_OPTIONS,
+
+  /* Streaming encoder finished before every row was encoded */
+  gct_ERR_INCOMPLETE_IMAGE,
+
+  /* Unsupported pixel format in an image descriptor */
+  gct_ERR_UNSUPPORTED_FORMAT,
+
+  /* File couldn't be opened or mapped into memory */
+  gct_ERR_FILE_ACCESS,
+
   gct_NUM_ERR_CODES
 };
 typedef int gct_error_t;
 
+/* Pixel formats of raw image data */
+enum gct_pixel_format_e {
+  /* 8-bit red, green, blue and alpha, same layout as gct_color_t */
+  gct_FORMAT_RGBA8 = 0,
+
+  /* 8-bit blue, green, red and alpha */
+  gct_FORMAT_BGRA8,
+
+  /* 8-bit red, green and blue, alpha is always 255 */
+  gct_FORMAT_RGB8,
+
+  /* Same as gct_FORMAT_RGBA8, with color multiplied by alpha.
+   * Color is divided by alpha before it's encoded */
+  gct_FORMAT_RGBA8_PREMUL,
+
+  /* 16-bit native endian 5-bit red (top bits), 6-bit green
+   * and 5-bit blue, alpha is thrown away. Decoder only */
+  gct_FORMAT_RGB565,
+
+  /* 8-bit alpha, color is thrown away. Decoder only,
+   * only the alpha plane is read */
+  gct_FORMAT_A8,
+
+  /* 1-bit mask, 8 pixels per byte with the leftmost pixel in the top
+   * bit, each row of the output starts on a byte. A bit is set if the
+   * pixel's alpha is at least the mask threshold in the decoder options,
+   * bits of pixels outside the image are left untouched. Decoder only,
+   * supported by gct_DecodeImage and gct_DecodeFile, and only the alpha
+   * plane is read */
+  gct_FORMAT_MASK1,
+
+  gct_NUM_FORMATS
+};
+typedef int gct_pixel_format_t;
+
+/* Description of raw image data, read in place by the encoder */
+typedef struct gct_image_desc_s {
+  /* First pixel of the top row */
+  const void *pixels;
+
+  /* Distance in bytes from one row to the next, can be negative
+   * for bottom-up images. Can be bigger than a row, to encode
+   * part of a bigger image */
+  gct_iptr stride;
+
+  gct_pixel_format_t format;
+} gct_image_desc_t;
+
+/* Rectangle of an image, in upright image coordinates */
+typedef struct gct_rect_s {
+  int x, y, width, height;
+} gct_rect_t;
+
+/* Encoder quality presets, each plane has its own preset */
+enum gct_quality_e {
+  /* Single pass, endpoints are picked without any refinement */
+  gct_QUALITY_FAST = 0,
+
+  /* Endpoints are refined with least squares (default) */
+  gct_QUALITY_HIGH,
+
+  /* Exhaustive search, tries a cluster fit for color blocks, and every
+   * endpoint pair that could be better for alpha blocks.
+   * Much slower than gct_QUALITY_HIGH, meant for final builds */
+  gct_QUALITY_EXHAUSTIVE,
+
+  /* Every block is compressed with gct_QUALITY_FAST first, blocks with
+   * an error above the adaptive threshold are compressed again with
+   * gct_QUALITY_HIGH, then with gct_QUALITY_EXHAUSTIVE if the error
+   * is still above the threshold */
+  gct_QUALITY_ADAPTIVE,
+
+  gct_NUM_QUALITIES
+};
+typedef int gct_quality_t;
+
+/* Encoder block counters
+ *
+ * Every 4x4 block of each plane is counted in exactly one
+ * field of that plane, or in blocksKept. Blocks that are
+ * constant or fully transparent skip the block compressor */
+typedef struct gct_encode_stats_s {
+  /* Color blocks where every pixel has an alpha of 0,
+   * these are encoded as the average color of the block */
+  gct_uptr colorTransparent;
+
+  /* Color blocks where every pixel has the same RGB color */
+  gct_uptr colorConstant;
+
+  /* Color blocks that went through the block compressor */
+  gct_uptr colorCompressed;
+
+  /* Alpha blocks where every pixel has the same alpha */
+  gct_uptr alphaConstant;
+
+  /* Alpha blocks that went through the block compressor */
+  gct_uptr alphaCompressed;
+
+  /* Blocks compressed more than once by gct_QUALITY_ADAPTIVE */
+  gct_uptr colorEscalated;
+  gct_uptr alphaEscalated;
+
+  /* Mean squared error per pixel of the encoded image, color error
+   * is summed over the RGB channels. Fully transparent color blocks
+   * aren't counted, since their color is thrown away */
+  double colorError;
+  double alphaError;
+
+  /* 4x4 blocks copied from the prior image in both planes
+   * because their pixels didn't change */
+  gct_uptr blocksKept;
+} gct_encode_stats_t;
+
+/* Pool of threads that's kept around between calls,
+ * so threads don't have to be started for every image */
+typedef struct gct_thread_pool_s gct_thread_pool_t;
+
+/* Encoder options
+ *
+ * Always initialize with gct_InitEncodeOptions before
+ * setting any fields, so fields added later get their defaults */
+typedef struct gct_encode_options_s {
+  /* Number of threads used to encode the image,
+   * <= 0 uses one thread per logical processor
+   *
+   * The image is split into strips of 8-pixel rows,
+   * output doesn't depend on the number of threads */
+  int numThreads;
+
+  /* Thread pool to encode on, numThreads is ignored when
+   * it isn't NULL. A pool can be shared by any number of encoders,
+   * calls using the same pool run one after another */
+  gct_thread_pool_t *pool;
+
+  /* Output pointer to block counters, filled in on success,
+   * NULL to not count blocks */
+  gct_encode_stats_t *stats;
+
+  /* Quality presets of the color and alpha planes */
+  gct_quality_t colorQuality;
+  gct_quality_t alphaQuality;
+
+  /* Mean squared error per pixel and channel, blocks above it are
+   * compressed again when using gct_QUALITY_ADAPTIVE (default 16) */
+  double adaptiveThreshold;
+
+  /* Store the image bottom-up, input rows are read from the bottom
+   * row up while encoding. Headers of these images should have their
+   * orientation set to -1, so they're decoded upright.
+   * Streaming encoders write the blocks of the first rows fed in at
+   * the end of each plane, so sinks get them from the bottom up */
+  gct_b32 flip;
+
+  /* CMPR data of an earlier version of the image, with the same size
+   * and flip, NULL to encode from scratch. Can be the output itself.
+   *
+   * Endpoints of its blocks are where the new blocks start from instead
+   * of PCA, so blocks that barely changed keep similar endpoints. Color
+   * blocks with an error above adaptiveThreshold are compressed from
+   * scratch as well, and the better block is kept.
+   * Only used by gct_EncodeEx, gct_EncodeImage and gct_EncodeRects */
+  const void *prior;
+
+  /* Hash of the pixels of every 4x4 block, in the order blocks are
+   * stored ((width / 4) * (height / 4) entries), NULL to not hash.
+   *
+   * Hashes of the input are written here. When prior is set, blocks
+   * whose hash didn't change are first copied from prior as they are,
+   * so keep the hashes around with the encoded image.
+   * Only used by the same functions as prior */
+  gct_u32 *blockHashes;
+} gct_encode_options_t;
+
+/* Block compressed formats CMPR can be transcoded to */
+enum gct_block_format_e {
+  /* BC1 (DXT1), 8 bytes per 4x4 block, only has the color plane */
+  gct_BLOCK_BC1 = 0,
+
+  /* BC3 (DXT5), 16 bytes per 4x4 block, a BC4 alpha block
+   * from the alpha plane, then a BC1 block from the color plane */
+  gct_BLOCK_BC3,
+
+  gct_NUM_BLOCK_FORMATS
+};
+typedef int gct_block_format_t;
+
+/* Where gct_ImportBC1 gets the alpha plane from */
+enum gct_alpha_source_e {
+  /* 1-bit alpha of the BC1 color blocks, pixels using the transparent
+   * entry of 3-color blocks get 0, every other pixel gets 255 */
+  gct_ALPHA_PUNCHTHROUGH = 0,
+
+  /* BC1 blocks with alpha in the green channel, laid out like the
+   * color blocks. These are copied, the same as the color blocks */
+  gct_ALPHA_BC1,
+
+  /* BC4 blocks laid out like the color blocks, compressed again */
+  gct_ALPHA_BC4,
+
+  /* 8-bit alpha values, compressed again */
+  gct_ALPHA_RAW,
+
+  gct_NUM_ALPHA_SOURCES
+};
+typedef int gct_alpha_source_t;
+
+/* Block compressed image imported by gct_ImportBC1. Blocks are stored
+ * left to right, then top to bottom, like the top level of a DDS file */
+typedef struct gct_bc1_source_s {
+  /* BC1 color blocks */
+  const void *color;
+
+  /* Source of the alpha plane, and its data. Unused for
+   * gct_ALPHA_PUNCHTHROUGH */
+  gct_alpha_source_t alphaSource;
+  const void *alpha;
+
+  /* Distance in bytes from one row of alpha values to the next,
+   * only used for gct_ALPHA_RAW */
+  gct_iptr alphaStride;
+
+  /* Quality preset of alpha blocks that are compressed again,
+   * gct_QUALITY_ADAPTIVE isn't supported */
+  gct_quality_t alphaQuality;
+} gct_bc1_source_t;
+
+/* Description of raw image data written by the decoder */
+typedef struct gct_output_desc_s {
+  /* First pixel of the first row in memory */
+  void *pixels;
+
+  /* Distance in bytes from one row to the next, can be negative */
+  gct_iptr stride;
+
+  gct_pixel_format_t format;
+
+  /* Store rows bottom-up, so the first row in memory
+   * is the bottom row of the image */
+  gct_b32 flip;
+} gct_output_desc_t;
+
+/* Decoder options
+ *
+ * Always initialize with gct_InitDecodeOptions before
+ * setting any fields, so fields added later get their defaults */
+typedef struct gct_decode_options_s {
+  /* Number of threads used to decode the image,
+   * <= 0 uses one thread per logical processor
+   *
+   * The image is split into strips of 8-pixel rows */
+  int numThreads;
+
+  /* Thread pool to decode on, numThreads is ignored when
+   * it isn't NULL. Can be shared with the encoder */
+  gct_thread_pool_t *pool;
+
+  /* Pixels with an alpha of at least this are set in
+   * gct_FORMAT_MASK1 output (default 128) */
+  int maskThreshold;
+} gct_decode_options_t;
+
+/* GCT file opened by gct_OpenFile or gct_OpenMemory,
+ * the header is only checked once when it's opened */
+typedef struct gct_file_s gct_file_t;
+
+/* Parts of an opened GCT file */
+typedef struct gct_file_info_s {
+  /* Whole file, starting with the header */
+  const void *data;
+  gct_uptr size;
+
+  int width, height;
+  gct_hdr_flags_t flags;
+
+  /* Rows are stored bottom-up, orientation in the header is -1 */
+  gct_b32 flipped;
+
+  /* Color and alpha planes, each is planeSize bytes long */
+  const void *color;
+  const void *alpha;
+  gct_uptr planeSize;
+} gct_file_info_t;
+
+/* Cache of decoded tiles of any number of files, can be used by any
+ * number of threads at once. Least recently used tiles are evicted
+ * first once the cache is full */
+typedef struct gct_tile_cache_s gct_tile_cache_t;
+
+/* Tile cache counters */
+typedef struct gct_cache_stats_s {
+  /* Tiles that were found in the cache, and tiles that had to be
+   * decoded. Tiles decoded by two threads at once are both misses */
+  gct_uptr hits;
+  gct_uptr misses;
+
+  /* Tiles evicted to make room for other tiles */
+  gct_uptr evictions;
+
+  /* Tiles in the cache, and memory used by their pixels in bytes */
+  gct_uptr tiles;
+  gct_uptr bytes;
+} gct_cache_stats_t;
+
+/* Statistics of a GCT image, worked out from its blocks
+ * without decoding any pixels */
+typedef struct gct_image_stats_s {
+  /* Average of every pixel, rounded to the nearest value */
+  gct_color_t average;
+
+  /* Pixels with an alpha of 255, and pixels with an alpha of 0 */
+  gct_uptr opaquePixels;
+  gct_uptr transparentPixels;
+
+  /* Every pixel has an alpha of 255 */
+  gct_b32 opaque;
+
+  /* Smallest rectangle holding every pixel with an alpha above 0,
+   * in upright image coordinates. Width and height are 0 when
+   * every pixel is transparent */
+  int boundsX, boundsY, boundsWidth, boundsHeight;
+} gct_image_stats_t;
+
+/* Image analyzed by gct_AnalyzeBatch */
+typedef struct gct_analyze_job_s {
+  /* Raw GCT file data */
+  const void *file;
+
+  /* Statistics of the image, set by gct_AnalyzeBatch on success */
+  gct_image_stats_t stats;
+
+  /* Result of analyzing this image, set by gct_AnalyzeBatch */
+  gct_error_t result;
+} gct_analyze_job_t;
+
+/* Image placed in an atlas by gct_ComposeAtlas */
+typedef struct gct_atlas_part_s {
+  /* Raw GCT file data */
+  const void *file;
+
+  /* Position of the image in the atlas, in upright
+   * atlas coordinates. Both are multiples of 8 */
+  int x, y;
+} gct_atlas_part_t;
+
+/* Image encoded by gct_EncodeBatch */
+typedef struct gct_encode_job_s {
+  /* Same as the arguments of gct_EncodeImage */
+  const gct_header_t *hdr;
+  gct_image_desc_t input;
+  void *output;
+
+  /* Output pointer to block counters of this image,
+   * NULL to not count blocks */
+  gct_encode_stats_t *stats;
+
+  /* Result of encoding this image, set by gct_EncodeBatch */
+  gct_error_t result;
+} gct_encode_job_t;
+
+/* Output sink of the streaming encoder
+ *
+ * write is called with the encoded blocks of one plane, in order
+ * (from the bottom of the plane up when the flip option is set).
+ * offset is where data goes relative to the start of the plane,
+ * in the encoded data the color plane comes first, and the alpha
+ * plane starts (width * height) / 2 bytes after it.
+ * Anything other than gct_SUCCESS stops the encoder, and the error
+ * is returned by gct_EncodeRows and gct_EndEncode */
+typedef struct gct_sink_s {
+  gct_error_t (*write)(void *user, gct_uptr offset,
+                       const void *data, gct_uptr size);
+
+  /* Passed to write as is */
+  void *user;
+} gct_sink_t;
+
+/* Streaming encoder, encodes the image a few rows at a time
+ * so the whole image never has to be in memory */
+typedef struct gct_encode_stream_s gct_encode_stream_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -173,6 +572,195 @@ gct_iptr gct_EncodedSize(const gct_header_t *hdr);
 gct_error_t gct_Encode(const gct_header_t *hdr,
                        const gct_color_t *input, void *output);
 
+/* Initialize encoder options to their defaults
+ * (same behavior as gct_Encode)
+ *
+ * opts: Output pointer to options */
+void gct_InitEncodeOptions(gct_encode_options_t *opts);
+
+/* Encode raw image data to GCT image data, with options
+ *
+ * hdr: Input pointer to image header
+ * input: Raw RGBA input data (size in bytes = width * height * 4)
+ * output: CMPR output (size in bytes = gct_EncodedSize(hdr))
+ * opts: Input pointer to encoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_Encode, or
+ *  gct_ERR_OUT_OF_MEMORY if block counters couldn't be allocated
+ *  gct_ERR_INVALID_OPTIONS if a quality preset is invalid or
+ *    the adaptive threshold is negative */
+gct_error_t gct_EncodeEx(const gct_header_t *hdr, const gct_color_t *input,
+                         void *output, const gct_encode_options_t *opts);
+
+/* Encode image data in any pixel format to GCT image data
+ *
+ * hdr: Input pointer to image header
+ * input: Input pointer to image description, pixels
+ *   are read in place without being converted first
+ * output: CMPR output (size in bytes = gct_EncodedSize(hdr))
+ * opts: Input pointer to encoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_EncodeEx, or
+ *  gct_ERR_INVALID_SIZE if a row is bigger than the stride
+ *  gct_ERR_UNSUPPORTED_FORMAT if the pixel format is invalid
+ *    or can only be decoded to */
+gct_error_t gct_EncodeImage(const gct_header_t *hdr,
+                            const gct_image_desc_t *input, void *output,
+                            const gct_encode_options_t *opts);
+
+/* Encode only the parts of an image that changed, in place
+ *
+ * Supertiles overlapping any of the rectangles are encoded again
+ * from input, every other block of output is left as it is.
+ * Supertiles are encoded the same way as by gct_EncodeImage, so
+ * the output is the same as encoding the whole image again when
+ * nothing outside the rectangles changed
+ *
+ * hdr: Input pointer to image header
+ * input: Input pointer to image description of the whole image
+ * output: CMPR data of the image before it changed, updated in place
+ *   (size in bytes = gct_EncodedSize(hdr))
+ * rects: Regions of the image that changed, clipped to the image
+ * numRects: Number of rectangles
+ * opts: Input pointer to encoder options, NULL uses the defaults.
+ *   flip has to match how output was encoded. Block counters
+ *   only count the supertiles that were encoded again
+ *
+ * Return value:
+ *  Same as gct_EncodeImage, or
+ *  gct_ERR_NULL_POINTER if rects is NULL and numRects isn't 0
+ *  gct_ERR_OUT_OF_MEMORY if supertiles to encode couldn't be listed */
+gct_error_t gct_EncodeRects(const gct_header_t *hdr,
+                            const gct_image_desc_t *input, void *output,
+                            const gct_rect_t *rects, gct_uptr numRects,
+                            const gct_encode_options_t *opts);
+
+/* Encode many images at once
+ *
+ * Work is shared by every thread, big images are split into strips
+ * and small images are grouped together, then threads that run out of
+ * work take some from the others. Faster than encoding each image on
+ * its own when there are a lot of small images
+ *
+ * jobs: Images to encode, result of each one is set even on failure
+ * numJobs: Number of images
+ * opts: Input pointer to encoder options, NULL uses the defaults.
+ *   Block counters are given per image, so opts->stats is ignored.
+ *   A temporary pool is used if opts->pool is NULL, with one thread
+ *   per logical processor unless opts->numThreads is above 1.
+ *   Pass a pool of one thread to encode the batch on a single thread
+ *
+ * Return value:
+ *  gct_SUCCESS if every image was successfully encoded
+ *  gct_ERR_NULL_POINTER if jobs is NULL
+ *  gct_ERR_OUT_OF_MEMORY if work couldn't be allocated,
+ *    no image is encoded. Images that were already invalid keep
+ *    their own result
+ *  Otherwise result of the first image that failed */
+gct_error_t gct_EncodeBatch(gct_encode_job_t *jobs, gct_uptr numJobs,
+                            const gct_encode_options_t *opts);
+
+/* Create thread pool
+ *
+ * pool: Output pointer to the new pool
+ * numThreads: Number of threads, including the thread encoding,
+ *   <= 0 uses one thread per logical processor
+ *
+ * Return value:
+ *  gct_SUCCESS if the pool was created
+ *  gct_ERR_NULL_POINTER if pool is NULL
+ *  gct_ERR_OUT_OF_MEMORY if the pool couldn't be allocated */
+gct_error_t gct_CreateThreadPool(gct_thread_pool_t **pool, int numThreads);
+
+/* Stop threads of a pool and free it, it can't be in use
+ *
+ * pool: Thread pool, can be NULL */
+void gct_DestroyThreadPool(gct_thread_pool_t *pool);
+
+/* Start streaming encoder that writes to an output buffer
+ *
+ * Every call to gct_EncodeRows writes its blocks to output right away,
+ * output can be a memory-mapped file (past the header)
+ *
+ * stream: Output pointer to the new encoder
+ * hdr: Input pointer to image header
+ * output: CMPR output (size in bytes = gct_EncodedSize(hdr))
+ * opts: Input pointer to encoder options, NULL uses the defaults,
+ *   stats are filled in by gct_EndEncode
+ *
+ * Return value:
+ *  Same as gct_EncodeEx */
+gct_error_t gct_BeginEncode(gct_encode_stream_t **stream,
+                            const gct_header_t *hdr, void *output,
+                            const gct_encode_options_t *opts);
+
+/* Start streaming encoder that writes to sinks
+ *
+ * Blocks are handed to the sinks as soon as their rows are encoded,
+ * memory used by the encoder is proportional to the number of rows
+ * fed at once, so feeding 8 rows at a time only needs width * 8 bytes
+ *
+ * stream: Output pointer to the new encoder
+ * hdr: Input pointer to image header
+ * colorSink: Input pointer to sink of the color plane
+ * alphaSink: Input pointer to sink of the alpha plane
+ * opts: Same as gct_BeginEncode
+ *
+ * Return value:
+ *  Same as gct_EncodeEx, or
+ *  gct_ERR_NULL_POINTER if a sink's write function is NULL */
+gct_error_t gct_BeginEncodeToSinks(gct_encode_stream_t **stream,
+                                   const gct_header_t *hdr,
+                                   const gct_sink_t *colorSink,
+                                   const gct_sink_t *alphaSink,
+                                   const gct_encode_options_t *opts);
+
+/* Encode the next rows of the image
+ *
+ * Rows are split across the encoder threads, so feeding more
+ * rows at once lets more threads run
+ *
+ * stream: Streaming encoder
+ * rows: Raw RGBA input data (size in bytes = width * numRows * 4)
+ * numRows: Number of rows, a multiple of 8
+ *
+ * Return value:
+ *  gct_SUCCESS if rows were successfully encoded
+ *  gct_ERR_INVALID_SIZE if numRows isn't a multiple of 8 or
+ *    goes past the bottom of the image
+ *  gct_ERR_NULL_POINTER if stream or rows are NULL
+ *  gct_ERR_OUT_OF_MEMORY if the sink buffer couldn't be allocated
+ *  Error returned by a sink, which stops the encoder */
+gct_error_t gct_EncodeRows(gct_encode_stream_t *stream,
+                           const gct_color_t *rows, int numRows);
+
+/* Same as gct_EncodeRows, with rows in any pixel format
+ *
+ * stream: Streaming encoder
+ * rows: Input pointer to description of the rows
+ * numRows: Number of rows, a multiple of 8
+ *
+ * Return value:
+ *  Same as gct_EncodeRows, or
+ *  gct_ERR_INVALID_SIZE if a row is bigger than the stride
+ *  gct_ERR_UNSUPPORTED_FORMAT if the pixel format is invalid
+ *    or can only be decoded to */
+gct_error_t gct_EncodeImageRows(gct_encode_stream_t *stream,
+                                const gct_image_desc_t *rows, int numRows);
+
+/* Finish streaming encoder and free it
+ *
+ * stream: Streaming encoder, freed even if an error is returned
+ *
+ * Return value:
+ *  gct_SUCCESS if every row was successfully encoded
+ *  gct_ERR_INCOMPLETE_IMAGE if some rows weren't encoded
+ *  gct_ERR_NULL_POINTER if stream is NULL
+ *  Error returned by a sink */
+gct_error_t gct_EndEncode(gct_encode_stream_t *stream);
+
 /* Get size of raw image data required to decode
  * GCT image
  *
@@ -198,6 +786,352 @@ gct_iptr gct_DecodedSize(const void *file);
 gct_error_t gct_Decode(const void *file, int *width,
                        int *height, gct_color_t *output);
 
+/* Initialize decoder options to their defaults
+ * (same behavior as gct_Decode)
+ *
+ * opts: Output pointer to options */
+void gct_InitDecodeOptions(gct_decode_options_t *opts);
+
+/* Decode GCT file into raw image data, with options
+ *
+ * file: Raw GCT file data
+ * width: Output pointer to image width
+ * height: Output pointer to image height
+ * output: Output pointer to image data (size in bytes = gct_DecodedSize(file))
+ * opts: Input pointer to decoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_Decode */
+gct_error_t gct_DecodeEx(const void *file, int *width, int *height,
+                         gct_color_t *output, const gct_decode_options_t *opts);
+
+/* Decode part of a GCT file into raw image data
+ *
+ * Only supertiles that overlap the region are decoded, so a small
+ * region of a big image is fast. The region doesn't have to be aligned
+ * to supertiles, parts of it outside the image are left untouched
+ *
+ * file: Raw GCT file data
+ * x, y: Top left corner of the region in the image, can be negative
+ * width, height: Size of the region
+ * output: Output pointer to pixel (x, y) of the region
+ * stride: Distance in bytes from one output row to the next,
+ *   can be negative
+ * opts: Input pointer to decoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_Decode, or
+ *  gct_ERR_INVALID_SIZE if width or height is <= 0
+ *  gct_ERR_NULL_POINTER if file or output is NULL */
+gct_error_t gct_DecodeRect(const void *file, int x, int y,
+                           int width, int height, gct_color_t *output,
+                           gct_iptr stride, const gct_decode_options_t *opts);
+
+/* Decode region of a GCT file into raw image data in any pixel format
+ *
+ * Pixels are converted a supertile at a time while they're being
+ * decoded, there's no full-size RGBA copy of the image
+ *
+ * file: Raw GCT file data
+ * x, y, width, height: Region to decode, same as gct_DecodeRect.
+ *   Use 0, 0 and the size of the image to decode all of it
+ * output: Input pointer to description of the region's output,
+ *   when flipped the first row in memory is the bottom row of the region
+ * opts: Input pointer to decoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_DecodeRect, or
+ *  gct_ERR_UNSUPPORTED_FORMAT if the pixel format is invalid */
+gct_error_t gct_DecodeImage(const void *file, int x, int y,
+                            int width, int height,
+                            const gct_output_desc_t *output,
+                            const gct_decode_options_t *opts);
+
+/* Decode a quarter or an eighth size thumbnail of a GCT file
+ *
+ * Each pixel is the average of a 4x4 block or an 8x8 supertile, worked
+ * out from the palette of each block and how many pixels use each entry,
+ * so pixels of the image are never decoded
+ *
+ * file: Raw GCT file data
+ * scale: 4 for one pixel per block, 8 for one pixel per supertile
+ * output: Input pointer to description of the output, which is
+ *   (width / scale) by (height / scale) pixels
+ * opts: Input pointer to decoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_Decode, or
+ *  gct_ERR_NULL_POINTER if file or output is NULL
+ *  gct_ERR_INVALID_SIZE if scale isn't 4 or 8
+ *  gct_ERR_UNSUPPORTED_FORMAT if the pixel format is invalid */
+gct_error_t gct_DecodeThumbnail(const void *file, int scale,
+                                const gct_output_desc_t *output,
+                                const gct_decode_options_t *opts);
+
+/* Get statistics of a GCT file without decoding it
+ *
+ * Only block endpoints and index tables are read, alpha coverage and
+ * bounds only look at the alpha plane
+ *
+ * file: Raw GCT file data
+ * stats: Output pointer to statistics of the image
+ * opts: Input pointer to decoder options, NULL uses the defaults
+ *
+ * Return value:
+ *  Same as gct_Decode, or
+ *  gct_ERR_NULL_POINTER if file or stats is NULL
+ *  gct_ERR_OUT_OF_MEMORY if strips couldn't be allocated */
+gct_error_t gct_AnalyzeImage(const void *file, gct_image_stats_t *stats,
+                             const gct_decode_options_t *opts);
+
+/* Get statistics of many GCT files at once
+ *
+ * Each image is analyzed on one thread, and images are
+ * split between the threads
+ *
+ * jobs: Images to analyze, result of each one is set even on failure
+ * numJobs: Number of images
+ * opts: Input pointer to decoder options, NULL uses the defaults.
+ *   A temporary pool of opts->numThreads threads is used if
+ *   opts->pool is NULL
+ *
+ * Return value:
+ *  gct_SUCCESS if every image was successfully analyzed
+ *  gct_ERR_NULL_POINTER if jobs is NULL
+ *  gct_ERR_OUT_OF_MEMORY if the thread pool couldn't be allocated
+ *  Otherwise result of the first image that failed */
+gct_error_t gct_AnalyzeBatch(gct_analyze_job_t *jobs, gct_uptr numJobs,
+                             const gct_decode_options_t *opts);
+
+/* Crop a GCT file to a region on 8-pixel boundaries, without decoding it
+ *
+ * Supertiles of the region are copied as they are, so the crop is
+ * lossless. Everything in the header but the size is kept
+ *
+ * file: Raw GCT file data
+ * x, y: Top left corner of the region in upright image coordinates,
+ *   multiples of 8
+ * width, height: Size of the region, multiples of 8
+ * hdr: Output pointer to header of the cropped image,
+ *   copy this header to the start of the file.
+ * output: Output pointer to encoded data of the cropped image,
+ *   after the header (size in bytes = gct_EncodedSize(hdr)).
+ *   Can't overlap file
+ *
+ * Return value:
+ *  Same as gct_Decode, or
+ *  gct_ERR_NULL_POINTER if a pointer is NULL
+ *  gct_ERR_INVALID_SIZE if the region isn't on 8-pixel boundaries,
+ *    or doesn't fit in the image */
+gct_error_t gct_CropImage(const void *file, int x, int y,
+                          int width, int height,
+                          gct_header_t *hdr, void *output);
+
+/* Build an atlas out of GCT files, without decoding them
+ *
+ * Supertiles of each image are copied as they are, so the atlas is
+ * lossless. Images stored the other way up than the atlas have
+ * their blocks flipped, which is lossless too. Space no image
+ * covers is transparent black, and later images are drawn
+ * over earlier ones where they overlap
+ *
+ * hdr: Input pointer to header of the atlas,
+ *   copy this header to the start of the file.
+ * parts: Images in the atlas, and where they go
+ * numParts: Number of images
+ * output: Output pointer to encoded data of the atlas,
+ *   after the header (size in bytes = gct_EncodedSize(hdr)).
+ *   Can't overlap any image
+ *
+ * Return value:
+ *  gct_SUCCESS if the atlas was successfully built
+ *  gct_ERR_INVALID_SIZE if size in the header is invalid,
+ *    or if an image isn't on 8-pixel boundaries or doesn't fit
+ *  gct_ERR_UNSUPPORTED_FLAGS if flags in the header are unsupported
+ *  gct_ERR_NULL_POINTER if a pointer is NULL
+ *  Same as gct_Decode if an image is invalid, nothing is written then */
+gct_error_t gct_ComposeAtlas(const gct_header_t *hdr,
+                             const gct_atlas_part_t *parts,
+                             gct_uptr numParts, void *output);
+
+/* Open GCT file by mapping it into memory, pages of the file are only
+ * read when they're used
+ *
+ * file: Output pointer to the opened file
+ * path: Path of the file
+ *
+ * Return value:
+ *  gct_SUCCESS if the file was opened
+ *  gct_ERR_NULL_POINTER if a pointer is NULL
+ *  gct_ERR_FILE_ACCESS if the file couldn't be opened or mapped
+ *  gct_ERR_OUT_OF_MEMORY if memory couldn't be allocated
+ *  gct_ERR_UNSUPPORTED_IMAGE if image format is unsupported
+ *  gct_ERR_INVALID_IMAGE if image file is invalid, or is cut short */
+gct_error_t gct_OpenFile(gct_file_t **file, const char *path);
+
+/* Open GCT file that's already in memory, without copying it
+ *
+ * file: Output pointer to the opened file
+ * data: Raw GCT file data, has to stay around until the file is closed
+ * size: Size of data in bytes
+ *
+ * Return value:
+ *  Same as gct_OpenFile */
+gct_error_t gct_OpenMemory(gct_file_t **file, const void *data,
+                           gct_uptr size);
+
+/* Close GCT file, and unmap it if it was mapped
+ *
+ * file: File to close, can be NULL */
+void gct_CloseFile(gct_file_t *file);
+
+/* Get parts of an opened GCT file
+ *
+ * file: Opened file
+ *
+ * Return value:
+ *  Pointer to the parts of the file, valid until it's closed */
+const gct_file_info_t *gct_GetFileInfo(const gct_file_t *file);
+
+/* Decode region of an opened GCT file, same as gct_DecodeImage
+ * without checking the header again
+ *
+ * Return value:
+ *  Same as gct_DecodeImage */
+gct_error_t gct_DecodeFile(const gct_file_t *file, int x, int y,
+                           int width, int height,
+                           const gct_output_desc_t *output,
+                           const gct_decode_options_t *opts);
+
+/* Create cache of decoded tiles
+ *
+ * cache: Output pointer to the cache
+ * maxBytes: Most memory used by pixels of cached tiles, in bytes
+ * tileSize: Width and height of tiles, a multiple of 8 up to 4096,
+ *   0 uses 64x64 tiles
+ *
+ * Return value:
+ *  gct_SUCCESS if the cache was created
+ *  gct_ERR_NULL_POINTER if cache is NULL
+ *  gct_ERR_INVALID_SIZE if the tile size is invalid
+ *  gct_ERR_OUT_OF_MEMORY if memory couldn't be allocated */
+gct_error_t gct_CreateTileCache(gct_tile_cache_t **cache,
+                                gct_uptr maxBytes, int tileSize);
+
+/* Destroy tile cache, nothing can be using it
+ *
+ * cache: Cache to destroy, can be NULL */
+void gct_DestroyTileCache(gct_tile_cache_t *cache);
+
+/* Decode region of an opened GCT file through a tile cache
+ *
+ * Tiles overlapping the region are decoded and cached if they aren't
+ * cached yet, then the region is copied out of them. Tiles are
+ * cached by the file handle, so remove a file from the cache with
+ * gct_CacheRemoveFile before it's closed
+ *
+ * cache: Tile cache
+ * file: Opened file
+ * x, y, width, height, output: Same as gct_DecodeImage
+ *
+ * Return value:
+ *  gct_SUCCESS if the region was successfully decoded to output
+ *  gct_ERR_NULL_POINTER if a pointer is NULL
+ *  gct_ERR_INVALID_SIZE if width or height is <= 0
+ *  gct_ERR_UNSUPPORTED_FORMAT if the pixel format is invalid
+ *  gct_ERR_OUT_OF_MEMORY if a tile couldn't be allocated */
+gct_error_t gct_CacheDecode(gct_tile_cache_t *cache, const gct_file_t *file,
+                            int x, int y, int width, int height,
+                            const gct_output_desc_t *output);
+
+/* Remove every tile of a file from a tile cache
+ *
+ * cache: Tile cache, can be NULL
+ * file: File to remove */
+void gct_CacheRemoveFile(gct_tile_cache_t *cache, const gct_file_t *file);
+
+/* Get counters of a tile cache
+ *
+ * cache: Tile cache
+ * stats: Output pointer to counters */
+void gct_GetCacheStats(gct_tile_cache_t *cache, gct_cache_stats_t *stats);
+
+/* Build GCT file from BC1 blocks, without compressing the color plane
+ *
+ * Color blocks are moved into supertile order and their bytes are
+ * shuffled, so the color plane is exactly what the BC1 blocks decode to,
+ * including blocks in 3-color mode. The source is always top to bottom,
+ * it's stored bottom-up when the header's orientation says so
+ *
+ * hdr: Input pointer to GCT file header,
+ *   copy this header to the start of the file.
+ * src: Input pointer to description of the blocks
+ * output: Output pointer to encoded GCT data,
+ *   after the header (size in bytes = gct_EncodedSize(hdr))
+ *
+ * Return value:
+ *  gct_SUCCESS if the blocks were successfully imported to output
+ *  gct_ERR_INVALID_SIZE if size in the header is invalid
+ *  gct_ERR_UNSUPPORTED_FLAGS if flags in the header are unsupported
+ *  gct_ERR_NULL_POINTER if a pointer that's needed is NULL
+ *  gct_ERR_INVALID_OPTIONS if the alpha source or quality is invalid */
+gct_error_t gct_ImportBC1(const gct_header_t *hdr,
+                          const gct_bc1_source_t *src, void *output);
+
+/* Find the top level of a BC1 (DXT1) DDS file
+ *
+ * dds: Raw DDS file data
+ * size: Size of the file in bytes
+ * width, height: Output pointers to size of the image
+ * blocks: Output pointer to first block of the top level,
+ *   which can be used as the color blocks of gct_ImportBC1
+ *
+ * Return value:
+ *  gct_SUCCESS if the file holds BC1 blocks
+ *  gct_ERR_NULL_POINTER if a pointer is NULL
+ *  gct_ERR_INVALID_IMAGE if the file isn't a DDS file, or is cut short
+ *  gct_ERR_UNSUPPORTED_IMAGE if the blocks aren't BC1 */
+gct_error_t gct_ReadDDS(const void *dds, gct_uptr size, int *width,
+                        int *height, const void **blocks);
+
+/* Get size of the output of gct_Transcode
+ *
+ * file: Raw GCT file data
+ * format: Block format to transcode to
+ *
+ * Return value:
+ *  Size of transcoded image data on success
+ *  -gct_ERR_UNSUPPORTED_FORMAT if the block format is invalid
+ *  Same as gct_DecodedSize otherwise */
+gct_iptr gct_TranscodedSize(const void *file, gct_block_format_t format);
+
+/* Transcode GCT file into BC1 or BC3 blocks, without decoding pixels
+ *
+ * Blocks are stored left to right, then top to bottom, the way
+ * PC graphics APIs expect them. Blocks of bottom-up images are
+ * flipped, so the output is upright like gct_Decode. BC1 blocks are
+ * the CMPR color blocks with their bytes shuffled, so they're always
+ * exact. BC3 alpha blocks get BC4 endpoints that give the exact same
+ * levels when there are any, which is always the case for blocks with
+ * up to two levels, otherwise the closest levels are used. BC3 color
+ * blocks can't use 3-color mode, so blocks that need it are compressed
+ * again. Blocks that aren't exact are counted in lossyBlocks
+ *
+ * file: Raw GCT file data
+ * format: Block format to transcode to
+ * output: Output pointer to blocks
+ *   (size in bytes = gct_TranscodedSize(file, format))
+ * lossyBlocks: Output pointer to number of blocks that aren't exact,
+ *   can be NULL
+ *
+ * Return value:
+ *  Same as gct_Decode, or
+ *  gct_ERR_NULL_POINTER if file or output is NULL
+ *  gct_ERR_UNSUPPORTED_FORMAT if the block format is invalid
+ *  gct_ERR_OUT_OF_MEMORY if memory couldn't be allocated */
+gct_error_t gct_Transcode(const void *file, gct_block_format_t format,
+                          void *output, gct_uptr *lossyBlocks);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -18,38 +18,39 @@
 #include <cstddef>
 
 // Function prototypes
-static void *GetGCTFile(int argc, char **argv);
+static gct_file_t *GetGCTFile(int argc, char **argv);
 static void WriteFile(int argc, char **argv, void *imageData, gct_iptr dataSize);
 
 int main(int argc, char **argv) {
-  void *gctFile = GetGCTFile(argc, argv);
-
-  // Get decoded image data size
-  gct_iptr dataSize = gct_DecodedSize(gctFile);
-  if (dataSize < 0) {
-    printf("ERROR: Cannot get decoded image data size! (%s)\n", gct_StrError(dataSize));
-    free(gctFile);
-    return 1;
-  }
+  gct_file_t *gctFile = GetGCTFile(argc, argv);
+  if (!gctFile) return 1;
 
+  // Header was checked when the file was opened
+  const gct_file_info_t *info = gct_GetFileInfo(gctFile);
+  const gct_iptr dataSize = (gct_iptr)info->width * info->height * sizeof(gct_color_t);
   gct_color_t *imageData = (gct_color_t*)malloc(dataSize);
 
-  // Decode GCT file into imageData
-  int width, height;
-  gct_error_t err = gct_Decode(gctFile, &width, &height, imageData);
+  // Decode whole GCT file into imageData
+  gct_output_desc_t output;
+  output.pixels = imageData;
+  output.stride = info->width * sizeof(gct_color_t);
+  output.format = gct_FORMAT_RGBA8;
+  output.flip = gct_false;
+
+  gct_error_t err = gct_DecodeFile(gctFile, 0, 0, info->width, info->height, &output, NULL);
   if (err != gct_SUCCESS) {
     printf("ERROR: Cannot decode GCT image data! (%s)\n", gct_StrError(err));
-    free(gctFile);
+    gct_CloseFile(gctFile);
     free(imageData);
     return 1;
   }
 
   WriteFile(argc, argv, imageData, dataSize);
 
-  printf("Image size: %d %d\n", width, height);
+  printf("Image size: %d %d\n", info->width, info->height);
 
   // Free resources and exit
-  free(gctFile);
+  gct_CloseFile(gctFile);
   free(imageData);
 
   return 0;
@@ -59,22 +60,18 @@ int main(int argc, char **argv) {
 #define ARG_INPUT 1
 #define ARG_OUTPUT 2
 
-// Open GCT file, and return file data
-static void *GetGCTFile(int argc, char **argv) {
+// Open GCT file, it's mapped into memory instead of being read
+static gct_file_t *GetGCTFile(int argc, char **argv) {
   const char *inputName;
   if (argc < 2) inputName = "sampleImage.gct";
   else inputName = argv[ARG_INPUT];
 
-  FILE *f = fopen(inputName, "rb");
-
-  // Get file size
-  fseek(f, 0, SEEK_END);
-  const size_t retSize = ftell(f);
-  fseek(f, 0, SEEK_SET);
-
-  void *ret = malloc(retSize);
-  fread(ret, 1, retSize, f);
-  fclose(f);
+  gct_file_t *ret;
+  gct_error_t err = gct_OpenFile(&ret, inputName);
+  if (err != gct_SUCCESS) {
+    printf("ERROR: Cannot open GCT file! (%s)\n", gct_StrError(err));
+    return NULL;
+  }
 
   return ret;
 }
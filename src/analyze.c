@@ -0,0 +1,319 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Image statistics worked out from CMPR blocks, without decoding pixels
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "common.h"
+#include "thread.h"
+#include "cmpr.h"
+
+#include <stdlib.h>
+
+// Most tasks a batch is split into, jobs are grouped past this
+#define MAX_BATCH_TASKS 65536
+
+// Statistics of a strip of supertile rows
+typedef struct strip_stats_s {
+  // RGBA sums of every pixel
+  double sums[4];
+
+  gct_uptr opaquePixels, transparentPixels;
+
+  // Bounds of visible pixels in stored rows, x1 and y1 are
+  // exclusive. Empty while x0 >= x1
+  gct_i32 x0, y0, x1, y1;
+} strip_stats_t;
+
+// Analyzer state shared by every strip of an image
+typedef struct analyzer_s {
+  const gct_u8 *color, *alpha;
+  gct_i32 width, height;
+
+  // Statistics of each strip
+  strip_stats_t *strips;
+  int numStrips;
+} analyzer_t;
+
+// Count bits set in 16-bit value
+static int CountBits16(gct_u32 v) {
+  v -= (v >> 1) & 0x5555;
+  v = (v & 0x3333) + ((v >> 2) & 0x3333);
+  v = (v + (v >> 4)) & 0x0f0f;
+  return (int)((v + (v >> 8)) & 0x1f);
+}
+
+// First and last bits set in a 4-bit value, bit 3 is the first one
+static int FirstBit4(gct_u32 v) {
+  return v & 8 ? 0 : v & 4 ? 1 : v & 2 ? 2 : 3;
+}
+
+static int LastBit4(gct_u32 v) {
+  return v & 1 ? 3 : v & 2 ? 2 : v & 4 ? 1 : 0;
+}
+
+// Grow bounds to fit the visible pixels of a block at (x, y),
+// visible is a mask from AnalyzeAlphaBlock with at least one bit set
+static void AddBlockBounds(strip_stats_t *st, gct_i32 x, gct_i32 y,
+                           gct_u32 visible)
+{
+  const gct_u32 cols = (visible | (visible >> 4) | (visible >> 8) |
+                        (visible >> 12)) & 15;
+  const gct_u32 rows = (gct_u32)(((visible >> 12) & 15) ? 8 : 0) |
+    (((visible >> 8) & 15) ? 4 : 0) | (((visible >> 4) & 15) ? 2 : 0) |
+    ((visible & 15) ? 1 : 0);
+  const gct_i32 x0 = x + FirstBit4(cols), x1 = x + LastBit4(cols) + 1;
+  const gct_i32 y0 = y + FirstBit4(rows), y1 = y + LastBit4(rows) + 1;
+
+  if (st->x0 >= st->x1) {
+    st->x0 = x0;
+    st->y0 = y0;
+    st->x1 = x1;
+    st->y1 = y1;
+    return;
+  }
+
+  if (x0 < st->x0) st->x0 = x0;
+  if (y0 < st->y0) st->y0 = y0;
+  if (x1 > st->x1) st->x1 = x1;
+  if (y1 > st->y1) st->y1 = y1;
+}
+
+// Analyze supertile rows [yStart, yEnd) of an image, in supertiles
+static void AnalyzeRows(const analyzer_t *an, gct_i32 yStart, gct_i32 yEnd,
+                        strip_stats_t *st)
+{
+  const gct_i32 tilesX = an->width >> 3;
+  const gct_u8 *color, *alpha;
+  gct_u32 visible, opaque;
+  gct_i32 x, y;
+  int sums[4], i;
+
+  for (y = yStart; y < yEnd; ++y) {
+    for (x = 0; x < tilesX; ++x) {
+      color = an->color + ((gct_iptr)y*tilesX + x)*32;
+      alpha = an->alpha + ((gct_iptr)y*tilesX + x)*32;
+
+      // Sums of a supertile are at most 64*255,
+      // they're added up as doubles after each one
+      sums[0] = sums[1] = sums[2] = sums[3] = 0;
+
+      // Blocks are top left, top right, bottom left, then bottom right
+      for (i = 0; i < 4; ++i, color += 8, alpha += 8) {
+        SumColorBlock(color, sums);
+        AnalyzeAlphaBlock(alpha, sums + 3, &visible, &opaque);
+        st->opaquePixels += CountBits16(opaque);
+        st->transparentPixels += 16 - CountBits16(visible);
+
+        if (visible)
+          AddBlockBounds(st, x*8 + (i & 1)*4, y*8 + (i >> 1)*4, visible);
+      }
+
+      for (i = 0; i < 4; ++i)
+        st->sums[i] += sums[i];
+    }
+  }
+}
+
+// Set statistics of a strip to an empty strip
+static void InitStripStats(strip_stats_t *st) {
+  st->sums[0] = st->sums[1] = st->sums[2] = st->sums[3] = 0.0;
+  st->opaquePixels = st->transparentPixels = 0;
+  st->x0 = st->y0 = st->x1 = st->y1 = 0;
+}
+
+// Analyze strip of supertile rows
+static void AnalyzeStrip(void *arg, int index) {
+  const analyzer_t * const an = (analyzer_t*)arg;
+  const gct_iptr rows = an->height >> 3;
+
+  InitStripStats(an->strips + index);
+  AnalyzeRows(an, (gct_i32)(rows*index / an->numStrips),
+              (gct_i32)(rows*(index+1) / an->numStrips), an->strips + index);
+}
+
+// Add up statistics of every strip into the statistics of the image
+static void FinishStats(const analyzer_t *an, gct_b32 flipped,
+                        gct_image_stats_t *stats)
+{
+  const double numPixels = (double)an->width * an->height;
+  strip_stats_t total;
+  const strip_stats_t *st;
+  int i;
+
+  InitStripStats(&total);
+  for (i = 0; i < an->numStrips; ++i) {
+    st = an->strips + i;
+
+    total.sums[0] += st->sums[0];
+    total.sums[1] += st->sums[1];
+    total.sums[2] += st->sums[2];
+    total.sums[3] += st->sums[3];
+    total.opaquePixels += st->opaquePixels;
+    total.transparentPixels += st->transparentPixels;
+
+    if (st->x0 >= st->x1) continue;
+    if (total.x0 >= total.x1) {
+      total.x0 = st->x0;
+      total.y0 = st->y0;
+      total.x1 = st->x1;
+      total.y1 = st->y1;
+      continue;
+    }
+
+    if (st->x0 < total.x0) total.x0 = st->x0;
+    if (st->y0 < total.y0) total.y0 = st->y0;
+    if (st->x1 > total.x1) total.x1 = st->x1;
+    if (st->y1 > total.y1) total.y1 = st->y1;
+  }
+
+  // Round averages to the nearest value
+  stats->average.r = (gct_u8)(total.sums[0] / numPixels + 0.5);
+  stats->average.g = (gct_u8)(total.sums[1] / numPixels + 0.5);
+  stats->average.b = (gct_u8)(total.sums[2] / numPixels + 0.5);
+  stats->average.a = (gct_u8)(total.sums[3] / numPixels + 0.5);
+
+  stats->opaquePixels = total.opaquePixels;
+  stats->transparentPixels = total.transparentPixels;
+  stats->opaque = (double)total.opaquePixels == numPixels;
+
+  stats->boundsX = total.x0;
+  stats->boundsWidth = total.x1 - total.x0;
+  stats->boundsHeight = total.y1 - total.y0;
+
+  // Bounds of bottom-up images are flipped back to be upright
+  stats->boundsY = flipped && stats->boundsHeight ?
+    an->height - total.y1 : total.y0;
+}
+
+// Set up analyzer from the header of a GCT file
+static gct_error_t InitAnalyzer(analyzer_t *an, const void *file) {
+  const gct_header_t * const hdr = (gct_header_t*)file;
+  gct_error_t err;
+
+  err = ReadImageHeader(hdr, &an->width, &an->height);
+  if (err) return err;
+
+  an->color = (const gct_u8*)(hdr+1);
+  an->alpha = an->color + ((an->width*an->height) >> 1);
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_AnalyzeImage(const void *file, gct_image_stats_t *stats,
+                             const gct_decode_options_t *opts)
+{
+  gct_decode_options_t defaultOpts;
+  analyzer_t an;
+  gct_error_t err;
+  int numThreads;
+
+  if (!file || !stats) return gct_ERR_NULL_POINTER;
+
+  if (!opts) {
+    gct_InitDecodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  err = InitAnalyzer(&an, file);
+  if (err) return err;
+
+  // Never use more threads than there are supertile rows
+  numThreads = opts->pool ? GetPoolSize(opts->pool) : opts->numThreads;
+  if (numThreads <= 0) numThreads = GetCPUCount();
+  if (numThreads > (an.height >> 3)) numThreads = an.height >> 3;
+
+  an.numStrips = numThreads;
+  an.strips = (strip_stats_t*)malloc(sizeof(strip_stats_t) * numThreads);
+  if (!an.strips) return gct_ERR_OUT_OF_MEMORY;
+
+  if (opts->pool) RunPool(opts->pool, numThreads, AnalyzeStrip, &an);
+  else RunThreads(numThreads, AnalyzeStrip, &an);
+
+  FinishStats(&an, ImageFlipped((const gct_header_t*)file), stats);
+  free(an.strips);
+  return gct_SUCCESS;
+}
+
+// Jobs of a batch, and the number of tasks they're split into
+typedef struct batch_s {
+  gct_analyze_job_t *jobs;
+  gct_uptr numJobs;
+  int numTasks;
+} batch_t;
+
+// Analyze every image of a batch task on this thread
+static void AnalyzeBatchTask(void *arg, int index) {
+  const batch_t * const batch = (batch_t*)arg;
+  const gct_uptr start = batch->numJobs * index / batch->numTasks;
+  const gct_uptr end = batch->numJobs * (index+1) / batch->numTasks;
+  gct_analyze_job_t *job;
+  strip_stats_t st;
+  analyzer_t an;
+  gct_uptr i;
+
+  for (i = start; i < end; ++i) {
+    job = batch->jobs + i;
+
+    if (!job->file) {
+      job->result = gct_ERR_NULL_POINTER;
+      continue;
+    }
+
+    job->result = InitAnalyzer(&an, job->file);
+    if (job->result) continue;
+
+    // Whole image is one strip
+    an.strips = &st;
+    an.numStrips = 1;
+    AnalyzeStrip(&an, 0);
+    FinishStats(&an, ImageFlipped((const gct_header_t*)job->file),
+                &job->stats);
+  }
+}
+
+gct_error_t gct_AnalyzeBatch(gct_analyze_job_t *jobs, gct_uptr numJobs,
+                             const gct_decode_options_t *opts)
+{
+  gct_decode_options_t defaultOpts;
+  gct_thread_pool_t *pool;
+  batch_t batch;
+  gct_uptr i;
+  gct_error_t err;
+
+  if (!jobs) return gct_ERR_NULL_POINTER;
+  else if (!numJobs) return gct_SUCCESS;
+
+  if (!opts) {
+    gct_InitDecodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  pool = opts->pool;
+  if (!pool) {
+    err = gct_CreateThreadPool(&pool, opts->numThreads);
+    if (err) {
+      for (i = 0; i < numJobs; ++i) jobs[i].result = err;
+      return err;
+    }
+  }
+
+  // Images are small next to the cost of a task,
+  // so huge batches are split into groups of images
+  batch.jobs = jobs;
+  batch.numJobs = numJobs;
+  batch.numTasks = numJobs < MAX_BATCH_TASKS ? (int)numJobs : MAX_BATCH_TASKS;
+  RunPool(pool, batch.numTasks, AnalyzeBatchTask, &batch);
+
+  if (!opts->pool) gct_DestroyThreadPool(pool);
+
+  for (i = 0; i < numJobs; ++i) {
+    if (jobs[i].result) return jobs[i].result;
+  }
+
+  return gct_SUCCESS;
+}
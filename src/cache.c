@@ -0,0 +1,347 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Cache of decoded tiles, with least recently used tiles evicted first
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "common.h"
+#include "thread.h"
+
+#include <stdlib.h>
+
+// Default size of tiles in pixels, 8x8 supertiles
+#define DEFAULT_TILE_SIZE 64
+
+// Most hash buckets the cache ever has
+#define MAX_BUCKETS (1 << 20)
+
+// Decoded tile, pixels are RGBA rows of the cache's tile size
+typedef struct tile_s {
+  const gct_file_t *file;
+  gct_i32 tx, ty;
+
+  // Next tile in the same hash bucket,
+  // and neighbors in the least recently used list
+  struct tile_s *hashNext, *prev, *next;
+
+  // Readers copying out of the tile, and whether it's still in the
+  // cache. Tiles evicted while they're read are freed by the last reader
+  int refs;
+  gct_b32 cached;
+
+  gct_color_t pixels[];
+} tile_t;
+
+struct gct_tile_cache_s {
+  // Guards everything in the cache, tiles are decoded
+  // and copied without holding it
+  lock_t *lock;
+
+  // Hash table of cached tiles, the number of buckets is a power of 2
+  tile_t **buckets;
+  gct_uptr bucketMask;
+
+  // Cached tiles from most to least recently used
+  tile_t *head, *tail;
+
+  gct_i32 tileSize;
+  gct_uptr tileBytes, maxBytes;
+  gct_cache_stats_t stats;
+};
+
+// Get hash bucket of tile (tx, ty) of file
+static tile_t **TileBucket(const gct_tile_cache_t *cache,
+                           const gct_file_t *file, gct_i32 tx, gct_i32 ty)
+{
+  gct_uptr h = (gct_uptr)file >> 4;
+
+  h = h*0x9e3779b1u ^ (gct_u32)tx*0x85ebca6bu ^ (gct_u32)ty*0xc2b2ae35u;
+  return cache->buckets + ((h ^ (h >> 15)) & cache->bucketMask);
+}
+
+// Find cached tile, returns NULL if it isn't cached
+static tile_t *FindTile(const gct_tile_cache_t *cache,
+                        const gct_file_t *file, gct_i32 tx, gct_i32 ty)
+{
+  tile_t *tile = *TileBucket(cache, file, tx, ty);
+
+  while (tile && (tile->file != file || tile->tx != tx || tile->ty != ty))
+    tile = tile->hashNext;
+
+  return tile;
+}
+
+// Put tile at the front of the least recently used list
+static void PushFront(gct_tile_cache_t *cache, tile_t *tile) {
+  tile->prev = NULL;
+  tile->next = cache->head;
+  if (cache->head) cache->head->prev = tile;
+  else cache->tail = tile;
+  cache->head = tile;
+}
+
+// Take tile out of the least recently used list
+static void Unlink(gct_tile_cache_t *cache, tile_t *tile) {
+  if (tile->prev) tile->prev->next = tile->next;
+  else cache->head = tile->next;
+  if (tile->next) tile->next->prev = tile->prev;
+  else cache->tail = tile->prev;
+}
+
+// Take tile out of the cache, it's freed now
+// if nobody is reading it, or by the last reader
+static void RemoveTile(gct_tile_cache_t *cache, tile_t *tile) {
+  tile_t **link = TileBucket(cache, tile->file, tile->tx, tile->ty);
+
+  while (*link != tile) link = &(*link)->hashNext;
+  *link = tile->hashNext;
+  Unlink(cache, tile);
+
+  --cache->stats.tiles;
+  cache->stats.bytes -= cache->tileBytes;
+
+  tile->cached = gct_false;
+  if (!tile->refs) free(tile);
+}
+
+// Put decoded tile in the cache, evicting the least recently used
+// tiles until it fits. Tiles bigger than the whole cache aren't kept
+static void InsertTile(gct_tile_cache_t *cache, tile_t *tile) {
+  tile_t ** const bucket = TileBucket(cache, tile->file, tile->tx, tile->ty);
+
+  if (cache->tileBytes > cache->maxBytes) return;
+
+  while (cache->stats.bytes + cache->tileBytes > cache->maxBytes) {
+    RemoveTile(cache, cache->tail);
+    ++cache->stats.evictions;
+  }
+
+  tile->hashNext = *bucket;
+  *bucket = tile;
+  PushFront(cache, tile);
+  tile->cached = gct_true;
+
+  ++cache->stats.tiles;
+  cache->stats.bytes += cache->tileBytes;
+}
+
+// Get tile (tx, ty) of file for reading, decoding it if it isn't cached.
+// Tiles have to be released with ReleaseTile once they're read
+static gct_error_t AcquireTile(gct_tile_cache_t *cache, const gct_file_t *file,
+                               gct_i32 tx, gct_i32 ty, tile_t **out)
+{
+  gct_decode_options_t opts;
+  gct_output_desc_t desc;
+  tile_t *tile, *cached;
+
+  AcquireLock(cache->lock);
+  tile = FindTile(cache, file, tx, ty);
+  if (tile) {
+    ++cache->stats.hits;
+    ++tile->refs;
+    Unlink(cache, tile);
+    PushFront(cache, tile);
+    ReleaseLock(cache->lock);
+
+    *out = tile;
+    return gct_SUCCESS;
+  }
+
+  ++cache->stats.misses;
+  ReleaseLock(cache->lock);
+
+  // Decode on this thread without holding the lock, so other
+  // tiles can be read while this one is decoded
+  tile = (tile_t*)malloc(sizeof(tile_t) + cache->tileBytes);
+  if (!tile) return gct_ERR_OUT_OF_MEMORY;
+
+  tile->file = file;
+  tile->tx = tx;
+  tile->ty = ty;
+  tile->refs = 1;
+  tile->cached = gct_false;
+
+  desc.pixels = tile->pixels;
+  desc.stride = (gct_iptr)cache->tileSize * sizeof(gct_color_t);
+  desc.format = gct_FORMAT_RGBA8;
+  desc.flip = gct_false;
+  gct_InitDecodeOptions(&opts);
+  gct_DecodeFile(file, tx*cache->tileSize, ty*cache->tileSize,
+                 cache->tileSize, cache->tileSize, &desc, &opts);
+
+  // Another thread could have decoded the same tile meanwhile
+  AcquireLock(cache->lock);
+  cached = FindTile(cache, file, tx, ty);
+  if (cached) {
+    ++cached->refs;
+    ReleaseLock(cache->lock);
+
+    free(tile);
+    *out = cached;
+    return gct_SUCCESS;
+  }
+
+  InsertTile(cache, tile);
+  ReleaseLock(cache->lock);
+
+  *out = tile;
+  return gct_SUCCESS;
+}
+
+// Release tile from AcquireTile
+static void ReleaseTile(gct_tile_cache_t *cache, tile_t *tile) {
+  gct_b32 unused;
+
+  AcquireLock(cache->lock);
+  unused = !--tile->refs && !tile->cached;
+  ReleaseLock(cache->lock);
+
+  if (unused) free(tile);
+}
+
+gct_error_t gct_CreateTileCache(gct_tile_cache_t **cache,
+                                gct_uptr maxBytes, int tileSize)
+{
+  gct_tile_cache_t *c;
+  gct_uptr maxTiles, numBuckets;
+
+  if (!cache) return gct_ERR_NULL_POINTER;
+
+  if (!tileSize) tileSize = DEFAULT_TILE_SIZE;
+  if (tileSize < 8 || tileSize > 4096 || (tileSize & 7))
+    return gct_ERR_INVALID_SIZE;
+
+  c = (gct_tile_cache_t*)malloc(sizeof(gct_tile_cache_t));
+  if (!c) return gct_ERR_OUT_OF_MEMORY;
+
+  c->tileSize = tileSize;
+  c->tileBytes = (gct_uptr)tileSize*tileSize * sizeof(gct_color_t);
+  c->maxBytes = maxBytes;
+
+  // About 2 buckets for every tile that fits
+  maxTiles = maxBytes / c->tileBytes;
+  for (numBuckets = 16; numBuckets < maxTiles*2 && numBuckets < MAX_BUCKETS;
+       numBuckets <<= 1);
+
+  c->lock = CreateLock();
+  c->buckets = (tile_t**)calloc(numBuckets, sizeof(tile_t*));
+  if (!c->lock || !c->buckets) {
+    if (c->lock) DestroyLock(c->lock);
+    free(c->buckets);
+    free(c);
+    return gct_ERR_OUT_OF_MEMORY;
+  }
+
+  c->bucketMask = numBuckets - 1;
+  c->head = c->tail = NULL;
+  c->stats.hits = c->stats.misses = c->stats.evictions = 0;
+  c->stats.tiles = c->stats.bytes = 0;
+
+  *cache = c;
+  return gct_SUCCESS;
+}
+
+void gct_DestroyTileCache(gct_tile_cache_t *cache) {
+  tile_t *tile, *next;
+
+  if (!cache) return;
+
+  for (tile = cache->head; tile; tile = next) {
+    next = tile->next;
+    free(tile);
+  }
+
+  DestroyLock(cache->lock);
+  free(cache->buckets);
+  free(cache);
+}
+
+gct_error_t gct_CacheDecode(gct_tile_cache_t *cache, const gct_file_t *file,
+                            int x, int y, int width, int height,
+                            const gct_output_desc_t *output)
+{
+  const gct_file_info_t *info;
+  tile_t *tile;
+  gct_u8 *pixels, *dest;
+  gct_iptr stride;
+  gct_i32 x0, y0, x1, y1, tx, ty, tileX, tileY, left, right, top, bottom, row;
+  int pixelSize;
+  gct_error_t err;
+
+  if (!cache || !file || !output || !output->pixels)
+    return gct_ERR_NULL_POINTER;
+  else if (width <= 0 || height <= 0)
+    return gct_ERR_INVALID_SIZE;
+
+  pixelSize = DecodedPixelSize(output->format);
+  if (!pixelSize) return gct_ERR_UNSUPPORTED_FORMAT;
+
+  // Flipped output is the same as starting from
+  // the bottom row and going upwards
+  pixels = (gct_u8*)output->pixels;
+  stride = output->stride;
+  if (output->flip) {
+    pixels += (height-1) * stride;
+    stride = -stride;
+  }
+
+  // Clip region to the image, parts outside it aren't written
+  info = gct_GetFileInfo(file);
+  x1 = x > info->width - width ? info->width : x + width;
+  y1 = y > info->height - height ? info->height : y + height;
+  x0 = x < 0 ? 0 : x;
+  y0 = y < 0 ? 0 : y;
+  if (x0 >= x1 || y0 >= y1) return gct_SUCCESS;
+
+  // Copy the part of each tile inside the region
+  for (ty = y0 / cache->tileSize; ty*cache->tileSize < y1; ++ty) {
+    tileY = ty*cache->tileSize;
+    top = tileY > y0 ? tileY : y0;
+    bottom = tileY + cache->tileSize < y1 ? tileY + cache->tileSize : y1;
+
+    for (tx = x0 / cache->tileSize; tx*cache->tileSize < x1; ++tx) {
+      tileX = tx*cache->tileSize;
+      left = tileX > x0 ? tileX : x0;
+      right = tileX + cache->tileSize < x1 ? tileX + cache->tileSize : x1;
+
+      err = AcquireTile(cache, file, tx, ty, &tile);
+      if (err) return err;
+
+      dest = pixels + (top - y)*stride + (left - x)*(gct_iptr)pixelSize;
+      for (row = top; row < bottom; ++row, dest += stride) {
+        ConvertRow(tile->pixels + (gct_iptr)(row - tileY)*cache->tileSize +
+                   (left - tileX), dest, right - left, output->format);
+      }
+
+      ReleaseTile(cache, tile);
+    }
+  }
+
+  return gct_SUCCESS;
+}
+
+void gct_CacheRemoveFile(gct_tile_cache_t *cache, const gct_file_t *file) {
+  tile_t *tile, *next;
+
+  if (!cache) return;
+
+  AcquireLock(cache->lock);
+  for (tile = cache->head; tile; tile = next) {
+    next = tile->next;
+    if (tile->file == file) RemoveTile(cache, tile);
+  }
+  ReleaseLock(cache->lock);
+}
+
+void gct_GetCacheStats(gct_tile_cache_t *cache, gct_cache_stats_t *stats) {
+  if (!cache || !stats) return;
+
+  AcquireLock(cache->lock);
+  *stats = cache->stats;
+  ReleaseLock(cache->lock);
+}
@@ -0,0 +1,381 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Cluster fit CMPR color block compressor
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "cmpr.h"
+
+#include <string.h>
+
+// Most times the pixels are reordered along the new endpoints
+#define MAX_ITERATIONS 8
+
+// Number of ways to split 16 ordered pixels into 4 clusters
+#define NUM_SPLITS 969
+
+// Least squares solution of every split, in the order they're tried.
+// Weights of max16 in each cluster are 3, 2, 1 and 0 thirds, for cluster
+// sizes n0-n3 this is 3/D, where D = P*Q - R*R and
+// P = 9*n0 + 4*n1 + n2, Q = n1 + 4*n2 + 9*n3, R = 2*(n1 + n2).
+// It's 0 when there's no unique solution
+static const float SplitFactor[NUM_SPLITS] = {
+  0.0f, 0.0222222228f, 0.0119047621f, 0.00854700897f, 0.0069444445f, 0.00606060587f,
+  0.00555555569f, 0.00529100513f, 0.00520833349f, 0.00529100513f, 0.00555555569f, 0.00606060587f,
+  0.0069444445f, 0.00854700897f, 0.0119047621f, 0.0222222228f, 0.0f, 0.00555555569f,
+  0.00469483575f, 0.00416666688f, 0.00383141753f, 0.00362318847f, 0.003508772f, 0.00347222225f,
+  0.003508772f, 0.00362318847f, 0.00383141753f, 0.00416666688f, 0.00469483575f, 0.00555555569f,
+  0.00709219836f, 0.010416667f, 0.0222222228f, 0.00297619053f, 0.00280112051f, 0.00268817204f,
+  0.00262467191f, 0.00260416674f, 0.00262467191f, 0.00268817204f, 0.00280112051f, 0.00297619053f,
+  0.00323624606f, 0.00362318847f, 0.00421940908f, 0.00520833349f, 0.00709219836f, 0.0119047621f,
+  0.00213675224f, 0.00209643599f, 0.00208333344f, 0.00209643599f, 0.00213675224f, 0.00220750552f,
+  0.00231481483f, 0.00246913591f, 0.00268817204f, 0.00300300308f, 0.00347222225f, 0.00421940908f,
+  0.00555555569f, 0.00854700897f, 0.00173611112f, 0.00174520072f, 0.00177304959f, 0.00182149361f,
+  0.00189393945f, 0.00199600798f, 0.00213675224f, 0.00233100238f, 0.00260416674f, 0.00300300308f,
+  0.00362318847f, 0.00469483575f, 0.0069444445f, 0.00151515147f, 0.00155038759f, 0.00160256412f,
+  0.00167504186f, 0.00177304959f, 0.00190476188f, 0.00208333344f, 0.00233100238f, 0.00268817204f,
+  0.00323624606f, 0.00416666688f, 0.00606060587f, 0.00138888892f, 0.00144300144f, 0.00151515147f,
+  0.00161030598f, 0.00173611112f, 0.00190476188f, 0.00213675224f, 0.00246913591f, 0.00297619053f,
+  0.00383141753f, 0.00555555569f, 0.00132275128f, 0.00139470014f, 0.00148809527f, 0.00161030598f,
+  0.00177304959f, 0.00199600798f, 0.00231481483f, 0.00280112051f, 0.00362318847f, 0.00529100513f,
+  0.00130208337f, 0.00139470014f, 0.00151515147f, 0.00167504186f, 0.00189393945f, 0.00220750552f,
+  0.00268817204f, 0.003508772f, 0.00520833349f, 0.00132275128f, 0.00144300144f, 0.00160256412f,
+  0.00182149361f, 0.00213675224f, 0.00262467191f, 0.00347222225f, 0.00529100513f, 0.00138888892f,
+  0.00155038759f, 0.00177304959f, 0.00209643599f, 0.00260416674f, 0.003508772f, 0.00555555569f,
+  0.00151515147f, 0.00174520072f, 0.00208333344f, 0.00262467191f, 0.00362318847f, 0.00606060587f,
+  0.00173611112f, 0.00209643599f, 0.00268817204f, 0.00383141753f, 0.0069444445f, 0.00213675224f,
+  0.00280112051f, 0.00416666688f, 0.00854700897f, 0.00297619053f, 0.00469483575f, 0.0119047621f,
+  0.00555555569f, 0.0222222228f, 0.0f, 0.00246913591f, 0.00231481483f, 0.00220750552f,
+  0.00213675224f, 0.00209643599f, 0.00208333344f, 0.00209643599f, 0.00213675224f, 0.00220750552f,
+  0.00231481483f, 0.00246913591f, 0.00268817204f, 0.00300300308f, 0.00347222225f, 0.00421940908f,
+  0.00555555569f, 0.00182149361f, 0.00177304959f, 0.00174520072f, 0.00173611112f, 0.00174520072f,
+  0.00177304959f, 0.00182149361f, 0.00189393945f, 0.00199600798f, 0.00213675224f, 0.00233100238f,
+  0.00260416674f, 0.00300300308f, 0.00362318847f, 0.00469483575f, 0.00149476831f, 0.00148809527f,
+  0.00149476831f, 0.00151515147f, 0.00155038759f, 0.00160256412f, 0.00167504186f, 0.00177304959f,
+  0.00190476188f, 0.00208333344f, 0.00233100238f, 0.00268817204f, 0.00323624606f, 0.00416666688f,
+  0.00130718958f, 0.00132275128f, 0.00134952762f, 0.00138888892f, 0.00144300144f, 0.00151515147f,
+  0.00161030598f, 0.00173611112f, 0.00190476188f, 0.00213675224f, 0.00246913591f, 0.00297619053f,
+  0.00383141753f, 0.00119474309f, 0.00122549024f, 0.00126742711f, 0.00132275128f, 0.00139470014f,
+  0.00148809527f, 0.00161030598f, 0.00177304959f, 0.00199600798f, 0.00231481483f, 0.00280112051f,
+  0.00362318847f, 0.00112994353f, 0.00117370894f, 0.00123001228f, 0.00130208337f, 0.00139470014f,
+  0.00151515147f, 0.00167504186f, 0.00189393945f, 0.00220750552f, 0.00268817204f, 0.003508772f,
+  0.00110011001f, 0.00115740742f, 0.00123001228f, 0.00132275128f, 0.00144300144f, 0.00160256412f,
+  0.00182149361f, 0.00213675224f, 0.00262467191f, 0.00347222225f, 0.00110011001f, 0.00117370894f,
+  0.00126742711f, 0.00138888892f, 0.00155038759f, 0.00177304959f, 0.00209643599f, 0.00260416674f,
+  0.003508772f, 0.00112994353f, 0.00122549024f, 0.00134952762f, 0.00151515147f, 0.00174520072f,
+  0.00208333344f, 0.00262467191f, 0.00362318847f, 0.00119474309f, 0.00132275128f, 0.00149476831f,
+  0.00173611112f, 0.00209643599f, 0.00268817204f, 0.00383141753f, 0.00130718958f, 0.00148809527f,
+  0.00174520072f, 0.00213675224f, 0.00280112051f, 0.00416666688f, 0.00149476831f, 0.00177304959f,
+  0.00220750552f, 0.00297619053f, 0.00469483575f, 0.00182149361f, 0.00231481483f, 0.00323624606f,
+  0.00555555569f, 0.00246913591f, 0.00362318847f, 0.00709219836f, 0.00421940908f, 0.010416667f,
+  0.0222222228f, 0.00132275128f, 0.00130718958f, 0.00130208337f, 0.00130718958f, 0.00132275128f,
+  0.00134952762f, 0.00138888892f, 0.00144300144f, 0.00151515147f, 0.00161030598f, 0.00173611112f,
+  0.00190476188f, 0.00213675224f, 0.00246913591f, 0.00297619053f, 0.00115740742f, 0.00116144016f,
+  0.00117370894f, 0.00119474309f, 0.00122549024f, 0.00126742711f, 0.00132275128f, 0.00139470014f,
+  0.00148809527f, 0.00161030598f, 0.00177304959f, 0.00199600798f, 0.00231481483f, 0.00280112051f,
+  0.00105485227f, 0.0010718113f, 0.00109649124f, 0.00112994353f, 0.00117370894f, 0.00123001228f,
+  0.00130208337f, 0.00139470014f, 0.00151515147f, 0.00167504186f, 0.00189393945f, 0.00220750552f,
+  0.00268817204f, 0.000992063549f, 0.00101936795f, 0.00105485227f, 0.00110011001f, 0.00115740742f,
+  0.00123001228f, 0.00132275128f, 0.00144300144f, 0.00160256412f, 0.00182149361f, 0.00213675224f,
+  0.00262467191f, 0.000957854383f, 0.000995024922f, 0.00104166672f, 0.00110011001f, 0.00117370894f,
+  0.00126742711f, 0.00138888892f, 0.00155038759f, 0.00177304959f, 0.00209643599f, 0.00260416674f,
+  0.000946969725f, 0.000995024922f, 0.00105485227f, 0.00112994353f, 0.00122549024f, 0.00134952762f,
+  0.00151515147f, 0.00174520072f, 0.00208333344f, 0.00262467191f, 0.000957854383f, 0.00101936795f,
+  0.00109649124f, 0.00119474309f, 0.00132275128f, 0.00149476831f, 0.00173611112f, 0.00209643599f,
+  0.00268817204f, 0.000992063549f, 0.0010718113f, 0.00117370894f, 0.00130718958f, 0.00148809527f,
+  0.00174520072f, 0.00213675224f, 0.00280112051f, 0.00105485227f, 0.00116144016f, 0.00130208337f,
+  0.00149476831f, 0.00177304959f, 0.00220750552f, 0.00297619053f, 0.00115740742f, 0.00130718958f,
+  0.00151515147f, 0.00182149361f, 0.00231481483f, 0.00323624606f, 0.00132275128f, 0.00155038759f,
+  0.00189393945f, 0.00246913591f, 0.00362318847f, 0.00160256412f, 0.00199600798f, 0.00268817204f,
+  0.00421940908f, 0.00213675224f, 0.00300300308f, 0.00520833349f, 0.00347222225f, 0.00709219836f,
+  0.0119047621f, 0.000949667592f, 0.000957854383f, 0.000971817295f, 0.000992063549f, 0.00101936795f,
+  0.00105485227f, 0.00110011001f, 0.00115740742f, 0.00123001228f, 0.00132275128f, 0.00144300144f,
+  0.00160256412f, 0.00182149361f, 0.00213675224f, 0.000888888899f, 0.000905797118f, 0.000928505091f,
+  0.000957854383f, 0.000995024922f, 0.00104166672f, 0.00110011001f, 0.00117370894f, 0.00126742711f,
+  0.00138888892f, 0.00155038759f, 0.00177304959f, 0.00209643599f, 0.000852514931f, 0.000877193001f,
+  0.00090826524f, 0.000946969725f, 0.000995024922f, 0.00105485227f, 0.00112994353f, 0.00122549024f,
+  0.00134952762f, 0.00151515147f, 0.00174520072f, 0.00208333344f, 0.000835421903f, 0.000868055562f,
+  0.00090826524f, 0.000957854383f, 0.00101936795f, 0.00109649124f, 0.00119474309f, 0.00132275128f,
+  0.00149476831f, 0.00173611112f, 0.00209643599f, 0.000835421903f, 0.000877193001f, 0.000928505091f,
+  0.000992063549f, 0.0010718113f, 0.00117370894f, 0.00130718958f, 0.00148809527f, 0.00174520072f,
+  0.00213675224f, 0.000852514931f, 0.000905797118f, 0.000971817295f, 0.00105485227f, 0.00116144016f,
+  0.00130208337f, 0.00149476831f, 0.00177304959f, 0.00220750552f, 0.000888888899f, 0.000957854383f,
+  0.00104493205f, 0.00115740742f, 0.00130718958f, 0.00151515147f, 0.00182149361f, 0.00231481483f,
+  0.000949667592f, 0.00104166672f, 0.00116144016f, 0.00132275128f, 0.00155038759f, 0.00189393945f,
+  0.00246913591f, 0.00104493205f, 0.00117370894f, 0.00134952762f, 0.00160256412f, 0.00199600798f,
+  0.00268817204f, 0.00119474309f, 0.00138888892f, 0.00167504186f, 0.00213675224f, 0.00300300308f,
+  0.00144300144f, 0.00177304959f, 0.00233100238f, 0.00347222225f, 0.00190476188f, 0.00260416674f,
+  0.00421940908f, 0.00300300308f, 0.00555555569f, 0.00854700897f, 0.000771604944f, 0.000788022066f,
+  0.000809061516f, 0.000835421903f, 0.000868055562f, 0.00090826524f, 0.000957854383f, 0.00101936795f,
+  0.00109649124f, 0.00119474309f, 0.00132275128f, 0.00149476831f, 0.00173611112f, 0.000750750769f,
+  0.000773395179f, 0.000801282062f, 0.000835421903f, 0.000877193001f, 0.000928505091f, 0.000992063549f,
+  0.0010718113f, 0.00117370894f, 0.00130718958f, 0.00148809527f, 0.00174520072f, 0.000744047633f,
+  0.000773395179f, 0.000809061516f, 0.000852514931f, 0.000905797118f, 0.000971817295f, 0.00105485227f,
+  0.00116144016f, 0.00130208337f, 0.00149476831f, 0.00177304959f, 0.000750750769f, 0.000788022066f,
+  0.000833333354f, 0.000888888899f, 0.000957854383f, 0.00104493205f, 0.00115740742f, 0.00130718958f,
+  0.00151515147f, 0.00182149361f, 0.000771604944f, 0.000819000823f, 0.000877193001f, 0.000949667592f,
+  0.00104166672f, 0.00116144016f, 0.00132275128f, 0.00155038759f, 0.00189393945f, 0.000809061516f,
+  0.000870321994f, 0.000946969725f, 0.00104493205f, 0.00117370894f, 0.00134952762f, 0.00160256412f,
+  0.00199600798f, 0.000868055562f, 0.000949667592f, 0.00105485227f, 0.00119474309f, 0.00138888892f,
+  0.00167504186f, 0.00213675224f, 0.000957854383f, 0.0010718113f, 0.00122549024f, 0.00144300144f,
+  0.00177304959f, 0.00233100238f, 0.00109649124f, 0.00126742711f, 0.00151515147f, 0.00190476188f,
+  0.00260416674f, 0.00132275128f, 0.00161030598f, 0.00208333344f, 0.00300300308f, 0.00173611112f,
+  0.00233100238f, 0.00362318847f, 0.00268817204f, 0.00469483575f, 0.0069444445f, 0.000673400646f,
+  0.000694444461f, 0.000719942385f, 0.000750750769f, 0.000788022066f, 0.000833333354f, 0.000888888899f,
+  0.000957854383f, 0.00104493205f, 0.00115740742f, 0.00130718958f, 0.00151515147f, 0.000673400646f,
+  0.000700280129f, 0.000732600747f, 0.000771604944f, 0.000819000823f, 0.000877193001f, 0.000949667592f,
+  0.00104166672f, 0.00116144016f, 0.00132275128f, 0.00155038759f, 0.000684462721f, 0.000718390802f,
+  0.000759301416f, 0.000809061516f, 0.000870321994f, 0.000946969725f, 0.00104493205f, 0.00117370894f,
+  0.00134952762f, 0.00160256412f, 0.000707714062f, 0.000750750769f, 0.000803212868f, 0.000868055562f,
+  0.000949667592f, 0.00105485227f, 0.00119474309f, 0.00138888892f, 0.00167504186f, 0.000745712139f,
+  0.000801282062f, 0.000870321994f, 0.000957854383f, 0.0010718113f, 0.00122549024f, 0.00144300144f,
+  0.00177304959f, 0.000803212868f, 0.000877193001f, 0.000971817295f, 0.00109649124f, 0.00126742711f,
+  0.00151515147f, 0.00190476188f, 0.000888888899f, 0.000992063549f, 0.00112994353f, 0.00132275128f,
+  0.00161030598f, 0.00208333344f, 0.00101936795f, 0.00117370894f, 0.00139470014f, 0.00173611112f,
+  0.00233100238f, 0.00123001228f, 0.00148809527f, 0.00190476188f, 0.00268817204f, 0.00161030598f,
+  0.00213675224f, 0.00323624606f, 0.00246913591f, 0.00416666688f, 0.00606060587f, 0.000617283978f,
+  0.000642260769f, 0.00067204301f, 0.000707714062f, 0.000750750769f, 0.000803212868f, 0.000868055562f,
+  0.000949667592f, 0.00105485227f, 0.00119474309f, 0.00138888892f, 0.000631313131f, 0.000662690552f,
+  0.000700280129f, 0.000745712139f, 0.000801282062f, 0.000870321994f, 0.000957854383f, 0.0010718113f,
+  0.00122549024f, 0.00144300144f, 0.000656167977f, 0.000695894239f, 0.000744047633f, 0.000803212868f,
+  0.000877193001f, 0.000971817295f, 0.00109649124f, 0.00126742711f, 0.00151515147f, 0.000694444461f,
+  0.000745712139f, 0.000809061516f, 0.000888888899f, 0.000992063549f, 0.00112994353f, 0.00132275128f,
+  0.00161030598f, 0.000750750769f, 0.000819000823f, 0.000905797118f, 0.00101936795f, 0.00117370894f,
+  0.00139470014f, 0.00173611112f, 0.000833333354f, 0.000928505091f, 0.00105485227f, 0.00123001228f,
+  0.00148809527f, 0.00190476188f, 0.000957854383f, 0.00110011001f, 0.00130208337f, 0.00161030598f,
+  0.00213675224f, 0.00115740742f, 0.00139470014f, 0.00177304959f, 0.00246913591f, 0.00151515147f,
+  0.00199600798f, 0.00297619053f, 0.00231481483f, 0.00383141753f, 0.00555555569f, 0.000587889459f,
+  0.000617283978f, 0.000652315735f, 0.000694444461f, 0.000745712139f, 0.000809061516f, 0.000888888899f,
+  0.000992063549f, 0.00112994353f, 0.00132275128f, 0.000613873533f, 0.000651041686f, 0.000695894239f,
+  0.000750750769f, 0.000819000823f, 0.000905797118f, 0.00101936795f, 0.00117370894f, 0.00139470014f,
+  0.000652315735f, 0.000700280129f, 0.000759301416f, 0.000833333354f, 0.000928505091f, 0.00105485227f,
+  0.00123001228f, 0.00148809527f, 0.000707714062f, 0.000771604944f, 0.000852514931f, 0.000957854383f,
+  0.00110011001f, 0.00130208337f, 0.00161030598f, 0.000788022066f, 0.000877193001f, 0.000995024922f,
+  0.00115740742f, 0.00139470014f, 0.00177304959f, 0.00090826524f, 0.00104166672f, 0.00123001228f,
+  0.00151515147f, 0.00199600798f, 0.00110011001f, 0.00132275128f, 0.00167504186f, 0.00231481483f,
+  0.00144300144f, 0.00189393945f, 0.00280112051f, 0.00220750552f, 0.00362318847f, 0.00529100513f,
+  0.000578703708f, 0.000613873533f, 0.000656167977f, 0.000707714062f, 0.000771604944f, 0.000852514931f,
+  0.000957854383f, 0.00110011001f, 0.00130208337f, 0.000617283978f, 0.000662690552f, 0.000718390802f,
+  0.000788022066f, 0.000877193001f, 0.000995024922f, 0.00115740742f, 0.00139470014f, 0.00067204301f,
+  0.000732600747f, 0.000809061516f, 0.00090826524f, 0.00104166672f, 0.00123001228f, 0.00151515147f,
+  0.000750750769f, 0.000835421903f, 0.000946969725f, 0.00110011001f, 0.00132275128f, 0.00167504186f,
+  0.000868055562f, 0.000995024922f, 0.00117370894f, 0.00144300144f, 0.00189393945f, 0.00105485227f,
+  0.00126742711f, 0.00160256412f, 0.00220750552f, 0.00138888892f, 0.00182149361f, 0.00268817204f,
+  0.00213675224f, 0.003508772f, 0.00520833349f, 0.000587889459f, 0.000631313131f, 0.000684462721f,
+  0.000750750769f, 0.000835421903f, 0.000946969725f, 0.00110011001f, 0.00132275128f, 0.000642260769f,
+  0.000700280129f, 0.000773395179f, 0.000868055562f, 0.000995024922f, 0.00117370894f, 0.00144300144f,
+  0.000719942385f, 0.000801282062f, 0.00090826524f, 0.00105485227f, 0.00126742711f, 0.00160256412f,
+  0.000835421903f, 0.000957854383f, 0.00112994353f, 0.00138888892f, 0.00182149361f, 0.00101936795f,
+  0.00122549024f, 0.00155038759f, 0.00213675224f, 0.00134952762f, 0.00177304959f, 0.00262467191f,
+  0.00209643599f, 0.00347222225f, 0.00529100513f, 0.000617283978f, 0.000673400646f, 0.000744047633f,
+  0.000835421903f, 0.000957854383f, 0.00112994353f, 0.00138888892f, 0.000694444461f, 0.000773395179f,
+  0.000877193001f, 0.00101936795f, 0.00122549024f, 0.00155038759f, 0.000809061516f, 0.000928505091f,
+  0.00109649124f, 0.00134952762f, 0.00177304959f, 0.000992063549f, 0.00119474309f, 0.00151515147f,
+  0.00209643599f, 0.00132275128f, 0.00174520072f, 0.00260416674f, 0.00208333344f, 0.003508772f,
+  0.00555555569f, 0.000673400646f, 0.000750750769f, 0.000852514931f, 0.000992063549f, 0.00119474309f,
+  0.00151515147f, 0.000788022066f, 0.000905797118f, 0.0010718113f, 0.00132275128f, 0.00174520072f,
+  0.000971817295f, 0.00117370894f, 0.00149476831f, 0.00208333344f, 0.00130718958f, 0.00173611112f,
+  0.00262467191f, 0.00209643599f, 0.00362318847f, 0.00606060587f, 0.000771604944f, 0.000888888899f,
+  0.00105485227f, 0.00130718958f, 0.00173611112f, 0.000957854383f, 0.00116144016f, 0.00148809527f,
+  0.00209643599f, 0.00130208337f, 0.00174520072f, 0.00268817204f, 0.00213675224f, 0.00383141753f,
+  0.0069444445f, 0.000949667592f, 0.00115740742f, 0.00149476831f, 0.00213675224f, 0.00130718958f,
+  0.00177304959f, 0.00280112051f, 0.00220750552f, 0.00416666688f, 0.00854700897f, 0.00132275128f,
+  0.00182149361f, 0.00297619053f, 0.00231481483f, 0.00469483575f, 0.0119047621f, 0.00246913591f,
+  0.00555555569f, 0.0222222228f, 0.0f
+};
+
+// Quantize channel to the given number of bits, then expand it
+// back to 8 bits by bit replication, same as the decoder
+static float QuantizeChannel(float c, int bits, float scale) {
+  int q;
+
+  if (c <= 0.0f) return 0.0f;
+  if (c >= 255.0f) return 255.0f;
+
+  q = (int)(c*scale + 0.5f);
+  return (float)((q << (8-bits)) | (q >> (2*bits-8)));
+}
+
+// Quantize color to RGB565, then expand it back to 8 bits
+static void QuantizeColor(float *c) {
+  c[0] = QuantizeChannel(c[0], 5, 31.0f/255.0f);
+  c[1] = QuantizeChannel(c[1], 6, 63.0f/255.0f);
+  c[2] = QuantizeChannel(c[2], 5, 31.0f/255.0f);
+}
+
+// Convert expanded color to RGB565
+static gct_u16 To565(const float *c) {
+  return (gct_u16)((((int)c[0] >> 3) << 11) | (((int)c[1] >> 2) << 5) |
+                   ((int)c[2] >> 3));
+}
+
+// Order pixels along axis, highest first so the first cluster is max16
+static void OrderPixels(const gct_color_t *block, const float *axis,
+                        gct_u8 *order)
+{
+  float dots[16], t;
+  int i, j;
+
+  for (i = 0; i < 16; ++i) {
+    t = block[i].r*axis[0] + block[i].g*axis[1] + block[i].b*axis[2];
+
+    for (j = i; j > 0 && dots[j-1] < t; --j) {
+      dots[j] = dots[j-1];
+      order[j] = order[j-1];
+    }
+    dots[j] = t;
+    order[j] = (gct_u8)i;
+  }
+}
+
+// Try every split of the ordered pixels, keeps the endpoints if they're
+// better than bestErr. Error is scaled by 9, without the squared pixel sum
+static void TrySplits(const gct_color_t *block, const gct_u8 *order,
+                      float *bestErr, float *bestA, float *bestB)
+{
+  // Prefix sums of each channel of the ordered pixels
+  float sr[17], sg[17], sb[17];
+  float bound[17], ax[3], bx[3], a[3], b[3];
+  float ar, ag, ab, br, bg, bb, axr, axg, axb, bxr, bxg, bxb;
+  float f, p, q, r, err;
+  int i, j, c0, c1, c2, split = 0;
+
+  sr[0] = sg[0] = sb[0] = 0.0f;
+  for (i = 0; i < 16; ++i) {
+    sr[i+1] = sr[i] + block[order[i]].r;
+    sg[i+1] = sg[i] + block[order[i]].g;
+    sb[i+1] = sb[i] + block[order[i]].b;
+  }
+
+  for (c0 = 0; c0 <= 16; ++c0) {
+    for (c1 = c0; c1 <= 16; split += 17-c1, ++c1) {
+      // Channel sums weighted by each endpoint, scaled by 3 along with
+      // the weights, when the third cluster is empty
+      const float ar0 = sr[c0]*3.0f + (sr[c1]-sr[c0])*2.0f;
+      const float ag0 = sg[c0]*3.0f + (sg[c1]-sg[c0])*2.0f;
+      const float ab0 = sb[c0]*3.0f + (sb[c1]-sb[c0])*2.0f;
+      const float br0 = (sr[c1]-sr[c0]) + (sr[16]-sr[c1])*3.0f;
+      const float bg0 = (sg[c1]-sg[c0]) + (sg[16]-sg[c1])*3.0f;
+      const float bb0 = (sb[c1]-sb[c0]) + (sb[16]-sb[c1])*3.0f;
+      const float p0 = (float)(c0*9 + (c1-c0)*4);
+      const float q0 = (float)((c1-c0) + (16-c1)*9);
+      const float r0 = (float)((c1-c0)*2);
+      const int num = 17-c1;
+
+      // Error of the unquantized endpoints of every split is the lowest
+      // it can get, this loop has no branches so it can be vectorized
+      for (j = 0; j < num; ++j) {
+        axr = ar0 + (sr[c1+j]-sr[c1]);
+        axg = ag0 + (sg[c1+j]-sg[c1]);
+        axb = ab0 + (sb[c1+j]-sb[c1]);
+        bxr = br0 - (sr[c1+j]-sr[c1]);
+        bxg = bg0 - (sg[c1+j]-sg[c1]);
+        bxb = bb0 - (sb[c1+j]-sb[c1]);
+
+        p = p0 + (float)j;
+        q = q0 - (float)(j*5);
+        r = r0 + (float)(j*2);
+        f = SplitFactor[split+j];
+
+        ar = (axr*q - bxr*r) * f;
+        ag = (axg*q - bxg*r) * f;
+        ab = (axb*q - bxb*r) * f;
+        br = (bxr*p - axr*r) * f;
+        bg = (bxg*p - axg*r) * f;
+        bb = (bxb*p - axb*r) * f;
+
+        bound[j] = -3.0f * (ar*axr + ag*axg + ab*axb + br*bxr + bg*bxg + bb*bxb);
+      }
+
+      // Only quantize splits that could be better
+      for (j = 0; j < num; ++j) {
+        if (bound[j] >= *bestErr || SplitFactor[split+j] == 0.0f) continue;
+
+        c2 = c1+j;
+        ax[0] = ar0 + (sr[c2]-sr[c1]);
+        ax[1] = ag0 + (sg[c2]-sg[c1]);
+        ax[2] = ab0 + (sb[c2]-sb[c1]);
+        bx[0] = br0 - (sr[c2]-sr[c1]);
+        bx[1] = bg0 - (sg[c2]-sg[c1]);
+        bx[2] = bb0 - (sb[c2]-sb[c1]);
+
+        p = p0 + (float)j;
+        q = q0 - (float)(j*5);
+        r = r0 + (float)(j*2);
+        f = SplitFactor[split+j];
+
+        for (i = 0; i < 3; ++i) {
+          a[i] = (ax[i]*q - bx[i]*r) * f;
+          b[i] = (bx[i]*p - ax[i]*r) * f;
+        }
+
+        QuantizeColor(a);
+        QuantizeColor(b);
+
+        err = 0.0f;
+        for (i = 0; i < 3; ++i) {
+          err += a[i]*a[i]*p + b[i]*b[i]*q + 2.0f*a[i]*b[i]*r -
+            6.0f*(a[i]*ax[i] + b[i]*bx[i]);
+        }
+
+        if (err < *bestErr) {
+          *bestErr = err;
+          memcpy(bestA, a, sizeof(a));
+          memcpy(bestB, b, sizeof(b));
+        }
+      }
+    }
+  }
+}
+
+gct_b32 ClusterFit(const gct_color_t *block, gct_u16 *max16,
+                   gct_u16 *min16, int maxErr)
+{
+  gct_u8 order[MAX_ITERATIONS][16];
+  float axis[3], bestA[3], bestB[3], bestErr, startErr, lastErr;
+  int i, j, sq = 0;
+
+  // Start along the line between the current endpoints
+  axis[0] = (float)((((*max16 >> 11) & 31) - ((*min16 >> 11) & 31)) * 2);
+  axis[1] = (float)(((*max16 >> 5) & 63) - ((*min16 >> 5) & 63));
+  axis[2] = (float)(((*max16 & 31) - (*min16 & 31)) * 2);
+  if (axis[0] == 0.0f && axis[1] == 0.0f && axis[2] == 0.0f)
+    return gct_false;
+
+  // Only look for endpoints better than maxErr, converted to
+  // the scaled error that doesn't include the squared pixel sum
+  for (i = 0; i < 16; ++i)
+    sq += block[i].r*block[i].r + block[i].g*block[i].g + block[i].b*block[i].b;
+  bestErr = startErr = (float)(maxErr - sq) * 9.0f;
+
+  for (i = 0; i < MAX_ITERATIONS; ++i) {
+    OrderPixels(block, axis, order[i]);
+
+    // Stop once the order repeats, it'll give the same endpoints
+    for (j = 0; j < i; ++j)
+      if (!memcmp(order[i], order[j], 16)) break;
+    if (j < i) break;
+
+    lastErr = bestErr;
+    TrySplits(block, order[i], &bestErr, bestA, bestB);
+    if (bestErr >= lastErr) break;
+
+    // Reorder along the best endpoints so far
+    axis[0] = bestA[0] - bestB[0];
+    axis[1] = bestA[1] - bestB[1];
+    axis[2] = bestA[2] - bestB[2];
+    if (axis[0] == 0.0f && axis[1] == 0.0f && axis[2] == 0.0f) break;
+  }
+
+  if (bestErr >= startErr) return gct_false;
+
+  *max16 = To565(bestA);
+  *min16 = To565(bestB);
+
+  return gct_true;
+}
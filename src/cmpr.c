@@ -0,0 +1,990 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  CMPR block compressor and decoder kernels
+ *  NOTE: This follows stb_compress_dxt_block in high quality mode,
+ *  but writes CMPR blocks directly and can run SIMD kernels.
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "cmpr.h"
+#include "cpu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Header-only DXT1 encoder by fabian "ryg" giesen and stb
+// Copyright(c) 2017 Sean Barrett
+// Look in stb_dxt.h for license information
+#define STB_DXT_IMPLEMENTATION
+#define STB_DXT_STATIC
+#include "thirdParty/stb_dxt.h"
+
+// Number of refinement passes, same as STB_DXT_HIGHQUAL
+#define REFINE_COUNT 2
+
+// Scalar kernels, color kernels are straight from stb_dxt
+static void OptimizeColorsScalar(const gct_color_t *block,
+                                 gct_u16 *max16, gct_u16 *min16)
+{
+  unsigned short mx, mn;
+
+  stb__OptimizeColorsBlock((unsigned char*)block, &mx, &mn);
+  *max16 = mx;
+  *min16 = mn;
+}
+
+static gct_u32 MatchColorsScalar(const gct_color_t *block, const gct_u8 *color) {
+  return stb__MatchColorsBlock((unsigned char*)block, (unsigned char*)color);
+}
+
+static gct_b32 RefineBlockScalar(const gct_color_t *block, gct_u16 *max16,
+                                 gct_u16 *min16, gct_u32 mask)
+{
+  unsigned short mx = *max16, mn = *min16;
+  gct_b32 ret;
+
+  ret = stb__RefineBlock((unsigned char*)block, &mx, &mn, mask);
+  *max16 = mx;
+  *min16 = mn;
+
+  return ret;
+}
+
+static int AlphaErrorScalar(const gct_u8 *alpha, const int *lv) {
+  int i, err = 0;
+
+  for (i = 0; i < 16; ++i) {
+    int d = abs(alpha[i] - lv[0]), t;
+
+    t = abs(alpha[i] - lv[1]); if (t < d) d = t;
+    t = abs(alpha[i] - lv[2]); if (t < d) d = t;
+    t = abs(alpha[i] - lv[3]); if (t < d) d = t;
+
+    err += d*d;
+  }
+
+  return err;
+}
+
+// Scalar decoder kernel
+
+// 16-bit color type
+typedef union color16_s {
+  struct {
+    gct_u16 b : 5;
+    gct_u16 g : 6;
+    gct_u16 r : 5;
+  } c;
+
+  gct_u16 p;
+} color16_t;
+typedef gct_be16_t color16_be_t;
+
+// DXT1 block to decode
+typedef struct block_s {
+  color16_be_t col0, col1;
+  gct_be32_t pixelTable;
+} block_t;
+
+// Alpha component
+typedef gct_u8 gct_alpha_t;
+
+// Convert color16_t into gct_color_t
+static void Color16To32(color16_t c16, gct_color_t *c32) {
+  // Round colors
+  c32->r = (c16.c.r << 3) | (c16.c.r >> 2);
+  c32->g = (c16.c.g << 2) | (c16.c.g >> 4);
+  c32->b = (c16.c.b << 3) | (c16.c.b >> 2);
+}
+
+// Convert alpha color16_t into gct_color_t
+static void Alpha16To32(color16_t a16, gct_alpha_t *out) {
+  // Round alpha
+  *out = (a16.c.g << 2) | (a16.c.g >> 4);
+}
+
+// Lerp 1 third of color a, and 2 thirds of color b
+static void Lerp13(const gct_color_t *a, const gct_color_t *b, gct_color_t *out) {
+  out->r = ((gct_u32)a->r + (gct_u32)b->r*2) / 3;
+  out->g = ((gct_u32)a->g + (gct_u32)b->g*2) / 3;
+  out->b = ((gct_u32)a->b + (gct_u32)b->b*2) / 3;
+}
+
+// Lerp halfway between colors a and b
+static void Lerp12(const gct_color_t *a, const gct_color_t *b, gct_color_t *out) {
+  out->r = ((gct_u32)a->r + (gct_u32)b->r) / 2;
+  out->g = ((gct_u32)a->g + (gct_u32)b->g) / 2;
+  out->b = ((gct_u32)a->b + (gct_u32)b->b) / 2;
+}
+
+// Get palette of an alpha block
+static void AlphaPalette(const block_t *ablk, gct_alpha_t *apal) {
+  color16_t acol0, acol1;
+
+  acol0.p = gct_BIG16(ablk->col0);
+  acol1.p = gct_BIG16(ablk->col1);
+
+  Alpha16To32(acol0, apal);
+  Alpha16To32(acol1, apal+1);
+
+  // Lerp alpha values, alpha blocks have
+  // a 3 color mode too, where index 3 is 0
+  if (acol0.p > acol1.p) {
+    apal[2] = (apal[0]*2 + apal[1]) / 3;
+    apal[3] = (apal[0] + apal[1]*2) / 3;
+  } else {
+    apal[2] = (apal[0] + apal[1]) / 2;
+    apal[3] = 0;
+  }
+}
+
+// Extract info from file block
+static void ExtractBlock(const block_t *blk, const block_t *ablk,
+                         gct_u32 *pixelTable, gct_u32 *aPixelTable,
+                         gct_color_t *pal, gct_alpha_t *apal)
+{
+  color16_t col0, col1;
+
+  col0.p = gct_BIG16(blk->col0);
+  col1.p = gct_BIG16(blk->col1);
+
+  Color16To32(col0, pal);
+  Color16To32(col1, pal+1);
+  if (col0.p > col1.p) {
+    Lerp13(pal+1, pal, pal+2);
+    Lerp13(pal, pal+1, pal+3);
+  } else {
+    // 3 color mode, the midpoint then black
+    Lerp12(pal, pal+1, pal+2);
+    pal[3].r = pal[3].g = pal[3].b = 0;
+  }
+
+  AlphaPalette(ablk, apal);
+
+  *pixelTable = gct_BIG32(blk->pixelTable);
+  *aPixelTable = gct_BIG32(ablk->pixelTable);
+}
+
+// Decode DXT1 block into image data
+static void DecodeDXT1(const block_t *blk, const block_t *ablk,
+                       gct_iptr stride, gct_color_t *out)
+{
+  gct_color_t pal[4];
+  gct_alpha_t apal[4];
+  gct_u32 pixelTable, aPixelTable;
+  gct_u32 i;
+
+  stride -= 4;
+
+  ExtractBlock(blk, ablk, &pixelTable, &aPixelTable, pal, apal);
+
+  // Write colors into image based on pixel table
+  for (i = 0; i < 16; ++i, ++out, pixelTable <<= 2, aPixelTable <<= 2) {
+    *out = pal[pixelTable >> 30];
+    out->a = apal[aPixelTable >> 30];
+
+    if ((i&3) == 3) out += stride;
+  }
+}
+
+// Count bits set in 32-bit value, only the low bit of each pair may be set
+static int CountPairBits(gct_u32 v) {
+  v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+  v = (v + (v >> 4)) & 0x0f0f0f0f;
+  return (int)((v * 0x01010101) >> 24);
+}
+
+// Count how many pixels use each index of a pixel table
+static void CountIndices(gct_u32 table, int *counts) {
+  const gct_u32 hi = (table >> 1) & 0x55555555;
+  const gct_u32 lo = table & 0x55555555;
+
+  counts[3] = CountPairBits(hi & lo);
+  counts[2] = CountPairBits(hi) - counts[3];
+  counts[1] = CountPairBits(lo) - counts[3];
+  counts[0] = 16 - counts[1] - counts[2] - counts[3];
+}
+
+// Sum a channel of every pixel from its 2 palette endpoints
+// and the number of pixels using each palette entry
+static int SumChannel(int a, int b, gct_b32 fourColors, const int *counts) {
+  // Selected rather than branched on, block modes are hard to predict.
+  // In 3-color blocks, index 3 is black or transparent
+  const int c2 = fourColors ? (a*2 + b)/3 : (a + b)/2;
+  const int c3 = fourColors ? (a + b*2)/3 : 0;
+
+  return a*counts[0] + b*counts[1] + c2*counts[2] + c3*counts[3];
+}
+
+void SumColorBlock(const gct_u8 *color, int *sums) {
+  const block_t * const blk = (const block_t*)color;
+  color16_t col0, col1;
+  gct_color_t c0, c1;
+  int counts[4];
+
+  col0.p = gct_BIG16(blk->col0);
+  col1.p = gct_BIG16(blk->col1);
+
+  Color16To32(col0, &c0);
+  Color16To32(col1, &c1);
+  CountIndices(gct_BIG32(blk->pixelTable), counts);
+
+  sums[0] += SumChannel(c0.r, c1.r, col0.p > col1.p, counts);
+  sums[1] += SumChannel(c0.g, c1.g, col0.p > col1.p, counts);
+  sums[2] += SumChannel(c0.b, c1.b, col0.p > col1.p, counts);
+}
+
+void SumBlockPixels(const gct_u8 *color, const gct_u8 *alpha, int *sums) {
+  const block_t * const ablk = (const block_t*)alpha;
+  color16_t acol0, acol1;
+  gct_alpha_t a0, a1;
+  int aCounts[4];
+
+  SumColorBlock(color, sums);
+
+  acol0.p = gct_BIG16(ablk->col0);
+  acol1.p = gct_BIG16(ablk->col1);
+
+  Alpha16To32(acol0, &a0);
+  Alpha16To32(acol1, &a1);
+  CountIndices(gct_BIG32(ablk->pixelTable), aCounts);
+
+  sums[3] += SumChannel(a0, a1, acol0.p > acol1.p, aCounts);
+}
+
+// Pack low bits of the pairs of a 32-bit value together
+static gct_u32 PackPairs(gct_u32 v) {
+  v = (v | (v >> 1)) & 0x33333333;
+  v = (v | (v >> 2)) & 0x0f0f0f0f;
+  v = (v | (v >> 4)) & 0x00ff00ff;
+  return (v | (v >> 8)) & 0xffff;
+}
+
+void AnalyzeAlphaBlock(const gct_u8 *alpha, int *sum,
+                       gct_u32 *visible, gct_u32 *opaque)
+{
+  const block_t * const ablk = (const block_t*)alpha;
+  const gct_u32 table = gct_BIG32(ablk->pixelTable);
+  const gct_u32 hi = (table >> 1) & 0x55555555;
+  const gct_u32 lo = table & 0x55555555;
+  gct_alpha_t apal[4];
+  gct_u32 entries[4], vis = 0, op = 0;
+  int i;
+
+  AlphaPalette(ablk, apal);
+
+  // Every pixel using the same entry is common,
+  // constant blocks are all index 2
+  if (table == 0 || table == 0x55555555 ||
+      table == 0xaaaaaaaa || table == 0xffffffff) {
+    *sum += apal[table & 3] * 16;
+    *visible = apal[table & 3] ? 0xffff : 0;
+    *opaque = apal[table & 3] == 255 ? 0xffff : 0;
+    return;
+  }
+
+  // Pixels using each entry, as the low bit of their pair
+  entries[0] = (hi | lo) ^ 0x55555555;
+  entries[1] = lo & ~hi;
+  entries[2] = hi & ~lo;
+  entries[3] = hi & lo;
+
+  for (i = 0; i < 4; ++i) {
+    *sum += apal[i] * CountPairBits(entries[i]);
+    vis |= -(gct_u32)(apal[i] != 0) & entries[i];
+    op |= -(gct_u32)(apal[i] == 255) & entries[i];
+  }
+
+  *visible = PackPairs(vis);
+  *opaque = PackPairs(op);
+}
+
+// Decode alpha block into 8-bit alpha values
+static void DecodeAlphaBlock(const block_t *ablk, gct_iptr stride,
+                             gct_alpha_t *out)
+{
+  gct_alpha_t apal[4];
+  gct_u32 aPixelTable;
+  int i;
+
+  stride -= 4;
+
+  AlphaPalette(ablk, apal);
+  aPixelTable = gct_BIG32(ablk->pixelTable);
+
+  for (i = 0; i < 16; ++i, ++out, aPixelTable <<= 2) {
+    *out = apal[aPixelTable >> 30];
+    if ((i&3) == 3) out += stride;
+  }
+}
+
+static void DecodeAlphaTileScalar(const gct_u8 *alpha, gct_iptr stride,
+                                  gct_u8 *out)
+{
+  const block_t * const ablk = (const block_t*)alpha;
+
+  DecodeAlphaBlock(ablk, stride, out);
+  DecodeAlphaBlock(ablk+1, stride, out+4);
+  DecodeAlphaBlock(ablk+2, stride, out + stride*4);
+  DecodeAlphaBlock(ablk+3, stride, out+4 + stride*4);
+}
+
+gct_u32 AlphaBlockMask(const gct_u8 *alpha, int threshold) {
+  const block_t * const ablk = (const block_t*)alpha;
+  const gct_u32 table = gct_BIG32(ablk->pixelTable);
+  const gct_u32 hi = (table >> 1) & 0x55555555;
+  const gct_u32 lo = table & 0x55555555;
+  gct_alpha_t apal[4];
+  gct_u32 mask;
+
+  // Only palette entries are compared, then every pixel using
+  // an entry that's set gets the low bit of its pair set
+  AlphaPalette(ablk, apal);
+  mask = (-(gct_u32)(apal[0] >= threshold) & ((hi | lo) ^ 0x55555555)) |
+    (-(gct_u32)(apal[1] >= threshold) & (lo & ~hi)) |
+    (-(gct_u32)(apal[2] >= threshold) & (hi & ~lo)) |
+    (-(gct_u32)(apal[3] >= threshold) & (hi & lo));
+
+  return PackPairs(mask);
+}
+
+void DecodeMaskTile(const gct_u8 *alpha, int threshold, gct_u8 *rows) {
+  gct_u32 m[4];
+  int r;
+
+  for (r = 0; r < 4; ++r)
+    m[r] = AlphaBlockMask(alpha + r*8, threshold);
+
+  for (r = 0; r < 4; ++r) {
+    rows[r] = (gct_u8)((((m[0] >> (12 - r*4)) & 15) << 4) |
+                       ((m[1] >> (12 - r*4)) & 15));
+    rows[r+4] = (gct_u8)((((m[2] >> (12 - r*4)) & 15) << 4) |
+                         ((m[3] >> (12 - r*4)) & 15));
+  }
+}
+
+static void DecodeTileScalar(const gct_u8 *color, const gct_u8 *alpha,
+                             gct_iptr stride, gct_color_t *out)
+{
+  const block_t * const blk = (const block_t*)color;
+  const block_t * const ablk = (const block_t*)alpha;
+
+  // Decode in CMPR subtile arrangement
+  DecodeDXT1(blk, ablk, stride, out);
+  DecodeDXT1(blk+1, ablk+1, stride, out+4);
+  DecodeDXT1(blk+2, ablk+2, stride, out + stride*4);
+  DecodeDXT1(blk+3, ablk+3, stride, out+4 + stride*4);
+}
+
+static const cmpr_kernels_t CMPRKernelsScalar = {
+  OptimizeColorsScalar,
+  MatchColorsScalar,
+  RefineBlockScalar,
+  AlphaErrorScalar,
+  DecodeTileScalar,
+  DecodeAlphaTileScalar
+};
+
+const cmpr_kernels_t *GetCMPRKernels(void) {
+#ifdef GCT_SIMD
+  const gct_u32 features = GetCPUFeatures();
+
+  if (features & CPU_AVX2) return &CMPRKernelsAVX2;
+  if (features & CPU_SSE2) return &CMPRKernelsSSE2;
+#endif
+
+  return &CMPRKernelsScalar;
+}
+
+gct_u16 As565(int r, int g, int b) {
+  return stb__As16Bit(r, g, b);
+}
+
+void PrincipalAxis(const int *cov, const int *minc,
+                   const int *maxc, int *axis)
+{
+  static const int nIterPower = 4;
+  float covf[6], vfr, vfg, vfb;
+  double magn;
+  int i;
+
+  // convert covariance matrix to float, find principal axis via power iter
+  for (i = 0; i < 6; ++i)
+    covf[i] = cov[i] / 255.0f;
+
+  vfr = (float)(maxc[0] - minc[0]);
+  vfg = (float)(maxc[1] - minc[1]);
+  vfb = (float)(maxc[2] - minc[2]);
+
+  for (i = 0; i < nIterPower; ++i) {
+    const float r = vfr*covf[0] + vfg*covf[1] + vfb*covf[2];
+    const float g = vfr*covf[1] + vfg*covf[3] + vfb*covf[4];
+    const float b = vfr*covf[2] + vfg*covf[4] + vfb*covf[5];
+
+    vfr = r;
+    vfg = g;
+    vfb = b;
+  }
+
+  magn = STBD_FABS(vfr);
+  if (STBD_FABS(vfg) > magn) magn = STBD_FABS(vfg);
+  if (STBD_FABS(vfb) > magn) magn = STBD_FABS(vfb);
+
+  if (magn < 4.0f) {
+    // too small, default to luminance
+    // (JPEG YCbCr luma coefs, scaled by 1000)
+    axis[0] = 299;
+    axis[1] = 587;
+    axis[2] = 114;
+  } else {
+    magn = 512.0 / magn;
+    axis[0] = (int)(vfr * magn);
+    axis[1] = (int)(vfg * magn);
+    axis[2] = (int)(vfb * magn);
+  }
+}
+
+void SingleColorEndpoints(int r, int g, int b,
+                          gct_u16 *max16, gct_u16 *min16)
+{
+  *max16 = (stb__OMatch5[r][0]<<11) | (stb__OMatch6[g][0]<<5) | stb__OMatch5[b][0];
+  *min16 = (stb__OMatch5[r][1]<<11) | (stb__OMatch6[g][1]<<5) | stb__OMatch5[b][1];
+}
+
+void SolveEndpoints(const int *at1, const int *sum, int xx, int yy, int xy,
+                    gct_u16 *max16, gct_u16 *min16)
+{
+  const int at2r = 3*sum[0] - at1[0];
+  const int at2g = 3*sum[1] - at1[1];
+  const int at2b = 3*sum[2] - at1[2];
+  const float f = 3.0f / 255.0f / (xx*yy - xy*xy);
+
+  *max16  = stb__Quantize5((at1[0]*yy - at2r*xy) * f) << 11;
+  *max16 |= stb__Quantize6((at1[1]*yy - at2g*xy) * f) << 5;
+  *max16 |= stb__Quantize5((at1[2]*yy - at2b*xy) * f);
+
+  *min16  = stb__Quantize5((at2r*xx - at1[0]*xy) * f) << 11;
+  *min16 |= stb__Quantize6((at2g*xx - at1[1]*xy) * f) << 5;
+  *min16 |= stb__Quantize5((at2b*xx - at1[2]*xy) * f);
+}
+
+// Write CMPR block, endpoints are big endian and
+// the first pixel is in the top bits of the index table
+static void WriteColorBlock(gct_u8 *dest, gct_u16 max16,
+                            gct_u16 min16, gct_u32 mask)
+{
+  // Colors have to be in descending order for 4 color mode
+  if (max16 < min16) {
+    const gct_u16 t = min16;
+    min16 = max16;
+    max16 = t;
+    mask ^= 0x55555555;
+  }
+
+  // Equal endpoints put the hardware in 3 color mode,
+  // where index 3 is black, so only use index 0
+  if (max16 == min16) mask = 0;
+
+  // Flip 2-bit indices in each byte
+  mask = ((mask & 0x33333333) << 2) | ((mask >> 2) & 0x33333333);
+  mask = ((mask & 0x0f0f0f0f) << 4) | ((mask >> 4) & 0x0f0f0f0f);
+
+  dest[0] = max16 >> 8;
+  dest[1] = max16 & 0xff;
+  dest[2] = min16 >> 8;
+  dest[3] = min16 & 0xff;
+  dest[4] = mask & 0xff;
+  dest[5] = (mask >> 8) & 0xff;
+  dest[6] = (mask >> 16) & 0xff;
+  dest[7] = mask >> 24;
+}
+
+// Get palette of a block the same way the decoder does,
+// as 4 RGBA entries like stb_dxt
+static void DecoderColors(gct_u8 *color, gct_u16 max16, gct_u16 min16) {
+  int i;
+
+  stb__From16Bit(color, max16);
+  stb__From16Bit(color+4, min16);
+
+  for (i = 0; i < 4; ++i) {
+    color[i+8] = (color[i]*2 + color[i+4]) / 3;
+    color[i+12] = (color[i] + color[i+4]*2) / 3;
+  }
+}
+
+// Match every pixel to the closest palette entry, unlike matchColors
+// this always finds the closest one. Returns squared error
+static int MatchColorsNearest(const gct_color_t *block, const gct_u8 *color,
+                              gct_u32 *mask)
+{
+  int i, j, dr, dg, db, d, best, bestIndex, err = 0;
+
+  *mask = 0;
+  for (i = 0; i < 16; ++i) {
+    best = 3*256*256;
+    bestIndex = 0;
+
+    for (j = 0; j < 4; ++j) {
+      dr = block[i].r - color[j*4];
+      dg = block[i].g - color[j*4+1];
+      db = block[i].b - color[j*4+2];
+      d = dr*dr + dg*dg + db*db;
+
+      if (d < best) {
+        best = d;
+        bestIndex = j;
+      }
+    }
+
+    err += best;
+    *mask |= (gct_u32)bestIndex << (i*2);
+  }
+
+  return err;
+}
+
+// Compress color block starting from endpoints max16 and min16
+static void CompressColorFrom(const cmpr_kernels_t *k, gct_u8 *dest,
+                              const gct_color_t *block, gct_quality_t quality,
+                              gct_u16 max16, gct_u16 min16)
+{
+  const int refineCount = (quality == gct_QUALITY_FAST) ? 0 : REFINE_COUNT;
+  gct_u8 color[16];
+  gct_u16 fitMax16, fitMin16;
+  gct_u32 mask, lastMask, fitMask;
+  int i, err;
+
+  // Map along the line between the endpoints
+  if (max16 != min16) {
+    stb__EvalColors(color, max16, min16);
+    mask = k->matchColors(block, color);
+  } else
+    mask = 0;
+
+  // Refine endpoints from the pixel mapping
+  for (i = 0; i < refineCount; ++i) {
+    lastMask = mask;
+
+    if (k->refineBlock(block, &max16, &min16, mask)) {
+      if (max16 != min16) {
+        stb__EvalColors(color, max16, min16);
+        mask = k->matchColors(block, color);
+      } else {
+        mask = 0;
+        break;
+      }
+    }
+
+    if (mask == lastMask) break;
+  }
+
+  // Cluster fit along the refined endpoints, then keep
+  // whichever endpoints decode closer to the block
+  if (quality == gct_QUALITY_EXHAUSTIVE) {
+    DecoderColors(color, max16, min16);
+    err = MatchColorsNearest(block, color, &mask);
+
+    fitMax16 = max16;
+    fitMin16 = min16;
+    if (err && ClusterFit(block, &fitMax16, &fitMin16, err)) {
+      DecoderColors(color, fitMax16, fitMin16);
+      if (MatchColorsNearest(block, color, &fitMask) < err) {
+        max16 = fitMax16;
+        min16 = fitMin16;
+        mask = fitMask;
+      }
+    }
+  }
+
+  WriteColorBlock(dest, max16, min16, mask);
+}
+
+void CompressColorBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                        const gct_color_t *block, gct_quality_t quality)
+{
+  gct_u16 max16, min16;
+
+  // These will give "unused function" warnings otherwise,
+  // kinda wish there was a way to disable their inclusion
+  (void)stb_compress_dxt_block;
+  (void)stb_compress_bc5_block;
+  (void)stb_compress_bc4_block;
+
+  // PCA gives the first endpoints
+  k->optimizeColors(block, &max16, &min16);
+  CompressColorFrom(k, dest, block, quality, max16, min16);
+}
+
+void WarmColorBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                    const gct_color_t *block, gct_quality_t quality,
+                    const gct_u8 *prior)
+{
+  // Read before dest is written, they can be the same block
+  const gct_u16 max16 = (gct_u16)((prior[0] << 8) | prior[1]);
+  const gct_u16 min16 = (gct_u16)((prior[2] << 8) | prior[3]);
+
+  // Equal endpoints don't give a direction to refine along
+  if (max16 == min16) {
+    CompressColorBlock(k, dest, block, quality);
+    return;
+  }
+
+  CompressColorFrom(k, dest, block, quality, max16, min16);
+}
+
+int ColorBlockError(const gct_u8 *src, const gct_color_t *block) {
+  gct_u8 color[16];
+  const gct_u32 mask = ((gct_u32)src[4] << 24) | ((gct_u32)src[5] << 16) |
+    ((gct_u32)src[6] << 8) | src[7];
+  int i, j, dr, dg, db, err = 0;
+
+  DecoderColors(color, (gct_u16)((src[0] << 8) | src[1]),
+                (gct_u16)((src[2] << 8) | src[3]));
+
+  for (i = 0; i < 16; ++i) {
+    j = ((mask >> (30 - i*2)) & 3) * 4;
+    dr = block[i].r - color[j];
+    dg = block[i].g - color[j+1];
+    db = block[i].b - color[j+2];
+    err += dr*dr + dg*dg + db*db;
+  }
+
+  return err;
+}
+
+void CompressConstantColor(gct_u8 *dest, int r, int g, int b) {
+  gct_u16 max16, min16;
+
+  // Color is matched by index 2 from the optimal match tables
+  SingleColorEndpoints(r, g, b, &max16, &min16);
+  WriteColorBlock(dest, max16, min16, 0xaaaaaaaa);
+}
+
+// Expand 6-bit green endpoint to 8 bits, same as the decoder
+#define EXPAND6(_g) (((_g) << 2) | ((_g) >> 4))
+
+// Endpoints for constant alpha blocks, the alpha value is matched
+// by index 2, every value is exact except for 18 that are off by one
+static const gct_u8 AlphaMatch[256][2] = {
+  { 0,  0}, { 0,  0}, { 1,  0}, { 1,  1}, { 1,  1}, { 2,  0}, { 2,  1}, { 2,  2},
+  { 2,  2}, { 3,  1}, { 3,  2}, { 3,  3}, { 3,  3}, { 4,  2}, { 4,  3}, { 4,  4},
+  { 4,  4}, { 5,  3}, { 5,  4}, { 5,  5}, { 5,  5}, { 6,  4}, { 6,  5}, { 6,  6},
+  { 6,  6}, { 7,  5}, { 7,  6}, { 7,  7}, { 7,  7}, { 8,  6}, { 8,  7}, { 8,  8},
+  { 8,  8}, { 9,  7}, { 9,  8}, { 9,  9}, { 9,  9}, {10,  8}, {10,  9}, {10, 10},
+  {10, 10}, {11,  9}, {11, 10}, {16,  0}, {11, 11}, {12, 10}, {12, 11}, {16,  3},
+  {12, 12}, {13, 11}, {13, 12}, {16,  6}, {13, 13}, {14, 12}, {14, 13}, {16,  9},
+  {14, 14}, {15, 13}, {15, 14}, {16, 12}, {15, 15}, {15, 15}, {16, 14}, {16, 15},
+  {17, 14}, {16, 16}, {17, 15}, {17, 16}, {18, 15}, {17, 17}, {18, 16}, {18, 17},
+  {20, 14}, {18, 18}, {19, 17}, {19, 18}, {21, 15}, {19, 19}, {20, 18}, {20, 19},
+  {23, 14}, {20, 20}, {21, 19}, {21, 20}, {24, 15}, {21, 21}, {22, 20}, {22, 21},
+  {26, 14}, {22, 22}, {23, 21}, {23, 22}, {27, 15}, {23, 23}, {24, 22}, {24, 23},
+  {29, 14}, {24, 24}, {25, 23}, {25, 24}, {30, 15}, {25, 25}, {26, 24}, {26, 25},
+  {32, 13}, {26, 26}, {27, 25}, {27, 26}, {32, 16}, {27, 27}, {28, 26}, {28, 27},
+  {32, 19}, {28, 28}, {29, 27}, {29, 28}, {32, 22}, {29, 29}, {30, 28}, {30, 29},
+  {32, 25}, {30, 30}, {31, 29}, {31, 30}, {32, 28}, {31, 31}, {40, 14}, {32, 30},
+  {32, 31}, {33, 30}, {32, 32}, {33, 31}, {33, 32}, {34, 31}, {33, 33}, {34, 32},
+  {34, 33}, {36, 30}, {34, 34}, {35, 33}, {35, 34}, {37, 31}, {35, 35}, {36, 34},
+  {36, 35}, {39, 30}, {36, 36}, {37, 35}, {37, 36}, {40, 31}, {37, 37}, {38, 36},
+  {38, 37}, {42, 30}, {38, 38}, {39, 37}, {39, 38}, {43, 31}, {39, 39}, {40, 38},
+  {40, 39}, {45, 30}, {40, 40}, {41, 39}, {41, 40}, {46, 31}, {41, 41}, {42, 40},
+  {42, 41}, {48, 29}, {42, 42}, {43, 41}, {43, 42}, {48, 32}, {43, 43}, {44, 42},
+  {44, 43}, {48, 35}, {44, 44}, {45, 43}, {45, 44}, {48, 38}, {45, 45}, {46, 44},
+  {46, 45}, {48, 41}, {46, 46}, {47, 45}, {47, 46}, {48, 44}, {47, 47}, {56, 30},
+  {48, 46}, {48, 47}, {49, 46}, {48, 48}, {49, 47}, {49, 48}, {50, 47}, {49, 49},
+  {50, 48}, {50, 49}, {52, 46}, {50, 50}, {51, 49}, {51, 50}, {53, 47}, {51, 51},
+  {52, 50}, {52, 51}, {55, 46}, {52, 52}, {53, 51}, {53, 52}, {56, 47}, {53, 53},
+  {54, 52}, {54, 53}, {58, 46}, {54, 54}, {55, 53}, {55, 54}, {59, 47}, {55, 55},
+  {56, 54}, {56, 55}, {61, 46}, {56, 56}, {57, 55}, {57, 56}, {62, 47}, {57, 57},
+  {58, 56}, {58, 57}, {58, 58}, {58, 58}, {59, 57}, {59, 58}, {59, 59}, {59, 59},
+  {60, 58}, {60, 59}, {60, 60}, {60, 60}, {61, 59}, {61, 60}, {61, 61}, {61, 61},
+  {62, 60}, {62, 61}, {62, 62}, {62, 62}, {63, 61}, {63, 62}, {63, 63}, {63, 63},
+};
+
+// Convert level position to index, level positions are
+// in ascending order, indices start from the high endpoint
+static const gct_u8 AlphaIndex[4] = {1, 3, 2, 0};
+
+// Get 6-bit value that expands closest to a
+static int Nearest6(int a) {
+  int g;
+
+  if (a <= 0) return 0;
+  if (a >= 255) return 63;
+
+  g = (a*63 + 127) / 255;
+  if (g > 0 && a - EXPAND6(g-1) < EXPAND6(g) - a) return g-1;
+  if (g < 63 && EXPAND6(g+1) - a < a - EXPAND6(g)) return g+1;
+  return g;
+}
+
+// Get alpha levels of the endpoints in ascending order, the position
+// of a level is how many thirds of the way it is from lo to hi
+static void AlphaLevels(int hi, int lo, int *lv) {
+  lv[0] = EXPAND6(lo);
+  lv[3] = EXPAND6(hi);
+  lv[1] = (lv[0]*2 + lv[3]) / 3;
+  lv[2] = (lv[0] + lv[3]*2) / 3;
+}
+
+// Get position of the level closest to a, by comparing
+// against the midpoints between levels
+#define ALPHA_POS(_lv, _a) \
+  (((_a)*2 > (_lv)[0]+(_lv)[1]) + ((_a)*2 > (_lv)[1]+(_lv)[2]) + \
+   ((_a)*2 > (_lv)[2]+(_lv)[3]))
+
+// Write CMPR alpha block, alpha is stored in the green channel
+// and the first value is in the top bits of the index table
+static void WriteAlphaBlock(gct_u8 *dest, int hi, int lo, gct_u32 mask) {
+  dest[0] = hi >> 3;
+  dest[1] = (hi << 5) & 0xff;
+  dest[2] = lo >> 3;
+  dest[3] = (lo << 5) & 0xff;
+  dest[4] = mask >> 24;
+  dest[5] = (mask >> 16) & 0xff;
+  dest[6] = (mask >> 8) & 0xff;
+  dest[7] = mask & 0xff;
+}
+
+// Get smallest 6-bit value that expands to at least v, 64 if there's none
+static int Ceil6(int v) {
+  int g;
+
+  if (v > 255) return 64;
+
+  g = Nearest6(v);
+  return (EXPAND6(g) < v) ? g+1 : g;
+}
+
+// Get largest 6-bit value that expands to at most v, -1 if there's none
+static int Floor6(int v) {
+  int g;
+
+  if (v < 0) return -1;
+
+  g = Nearest6(v);
+  return (EXPAND6(g) > v) ? g-1 : g;
+}
+
+// Round num/den to the closest 6-bit endpoint, den must be positive
+static int FitEndpoint(int num, int den) {
+  if (num <= 0) return 0;
+  return Nearest6((num*2 + den) / (den*2));
+}
+
+// Match alpha values to the closest level of hi and lo, then fit new
+// endpoints to them with least squares, asum is the sum of the values.
+// Returns 0 if the endpoints can't be solved
+static gct_b32 FitAlpha(const gct_u8 *alpha, int asum, int *hi, int *lo) {
+  int lv[4];
+  int i, xx, yy, xy, at1, at2, det, sp = 0, spp = 0, spa = 0;
+
+  // Weight of the high endpoint for a value matched to level position p
+  // is p/3, so only the sums of p, p*p and p*a are needed
+  AlphaLevels(*hi, *lo, lv);
+  for (i = 0; i < 16; ++i) {
+    const int p = ALPHA_POS(lv, alpha[i]);
+
+    sp += p;
+    spp += p*p;
+    spa += p*alpha[i];
+  }
+
+  // Everything is scaled by 3 to stay as integers
+  xx = spp;
+  yy = 144 - sp*6 + spp;
+  xy = sp*3 - spp;
+  at1 = spa;
+  at2 = asum*3 - spa;
+  det = xx*yy - xy*xy;
+
+  if (det <= 0) return 0;
+
+  *hi = FitEndpoint((at1*yy - at2*xy)*3, det);
+  *lo = FitEndpoint((at2*xx - at1*xy)*3, det);
+
+  return 1;
+}
+
+// Try every endpoint pair that could beat the best error so far,
+// a pair can't if the lowest value is more than r below the low
+// endpoint, or the highest value is more than r above the high one
+static void SearchAlpha(const cmpr_kernels_t *k, const gct_u8 *alpha,
+                        int amin, int amax, int *bestErr,
+                        int *bestHi, int *bestLo)
+{
+  int lv[4];
+  int r, hi, lo, hiFirst, loLast, err;
+
+  // Largest distance with a squared error below the best
+  for (r = 0; (r+1)*(r+1) < *bestErr; ++r);
+
+  hiFirst = Ceil6(amax - r);
+  loLast = Floor6(amin + r);
+  for (lo = 0; lo <= loLast; ++lo) {
+    for (hi = (hiFirst > lo) ? hiFirst : lo; hi < 64; ++hi) {
+      AlphaLevels(hi, lo, lv);
+      err = k->alphaError(alpha, lv);
+
+      if (err < *bestErr) {
+        *bestErr = err;
+        *bestHi = hi;
+        *bestLo = lo;
+        if (!err) return;
+      }
+    }
+  }
+}
+
+// Compress alpha block, also starting from the endpoints
+// of prior if it isn't NULL and they fit better
+static void CompressAlpha(const cmpr_kernels_t *k, gct_u8 *dest,
+                          const gct_u8 *alpha, gct_quality_t quality,
+                          const gct_u8 *prior)
+{
+  int lv[4];
+  int i, hi, lo, amin, amax, asum, asq, err, bestErr, bestHi, bestLo;
+  gct_u32 mask;
+
+  amin = amax = asum = alpha[0];
+  asq = alpha[0]*alpha[0];
+  for (i = 1; i < 16; ++i) {
+    const int a = alpha[i];
+
+    if (a < amin) amin = a;
+    if (a > amax) amax = a;
+    asum += a;
+    asq += a*a;
+  }
+
+  if (amin == amax) {
+    CompressConstantAlpha(dest, amin);
+    return;
+  }
+
+  // Start with endpoints closest to the extremes
+  bestHi = Nearest6(amax);
+  bestLo = Nearest6(amin);
+  if (quality == gct_QUALITY_FAST && !prior) goto match;
+
+  AlphaLevels(bestHi, bestLo, lv);
+  bestErr = k->alphaError(alpha, lv);
+
+  // Endpoints of the block this one replaces are kept on a tie,
+  // so blocks that barely changed keep their endpoints
+  if (prior) {
+    hi = ((prior[0] << 3) | (prior[1] >> 5)) & 63;
+    lo = ((prior[2] << 3) | (prior[3] >> 5)) & 63;
+
+    if (hi > lo) {
+      AlphaLevels(hi, lo, lv);
+      err = k->alphaError(alpha, lv);
+      if (err <= bestErr) {
+        bestErr = err;
+        bestHi = hi;
+        bestLo = lo;
+      }
+    }
+
+    if (quality == gct_QUALITY_FAST) goto match;
+  }
+
+  // Refine endpoints from the value mapping
+  for (i = 0; i < REFINE_COUNT && bestErr; ++i) {
+    hi = bestHi;
+    lo = bestLo;
+    if (!FitAlpha(alpha, asum, &hi, &lo) || hi < lo) break;
+    if (hi == bestHi && lo == bestLo) break;
+
+    AlphaLevels(hi, lo, lv);
+    err = k->alphaError(alpha, lv);
+    if (err >= bestErr) break;
+
+    bestErr = err;
+    bestHi = hi;
+    bestLo = lo;
+  }
+
+  // Nudge each endpoint by one step, rounding the fit to the
+  // closest endpoints isn't always best
+  for (i = 0; i < 4 && bestErr; ++i) {
+    hi = bestHi + (i == 0) - (i == 1);
+    lo = bestLo + (i == 2) - (i == 3);
+    if (hi > 63 || lo < 0 || hi < lo) continue;
+
+    AlphaLevels(hi, lo, lv);
+    err = k->alphaError(alpha, lv);
+    if (err < bestErr) {
+      bestErr = err;
+      bestHi = hi;
+      bestLo = lo;
+    }
+  }
+
+  // Try a single level, if it's the average
+  // its error is the variance of the values
+  hi = EXPAND6(Nearest6((asum+8) >> 4));
+  err = asq - 2*hi*asum + 16*hi*hi;
+  if (err < bestErr) {
+    bestErr = err;
+    bestHi = bestLo = Nearest6((asum+8) >> 4);
+  }
+
+  if (quality == gct_QUALITY_EXHAUSTIVE && bestErr)
+    SearchAlpha(k, alpha, amin, amax, &bestErr, &bestHi, &bestLo);
+
+match:
+  // Equal endpoints put the hardware in 3 color mode,
+  // where index 3 is transparent black, so only use index 0
+  mask = 0;
+  if (bestHi != bestLo) {
+    AlphaLevels(bestHi, bestLo, lv);
+    for (i = 0; i < 16; ++i)
+      mask = (mask << 2) | AlphaIndex[ALPHA_POS(lv, alpha[i])];
+  }
+
+  WriteAlphaBlock(dest, bestHi, bestLo, mask);
+}
+
+void CompressAlphaBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                        const gct_u8 *alpha, gct_quality_t quality)
+{
+  CompressAlpha(k, dest, alpha, quality, NULL);
+}
+
+void WarmAlphaBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                    const gct_u8 *alpha, gct_quality_t quality,
+                    const gct_u8 *prior)
+{
+  CompressAlpha(k, dest, alpha, quality, prior);
+}
+
+int AlphaBlockError(const gct_u8 *src, const gct_u8 *alpha) {
+  const gct_u32 mask = ((gct_u32)src[4] << 24) | ((gct_u32)src[5] << 16) |
+    ((gct_u32)src[6] << 8) | src[7];
+  int lv[4];
+  int i, d, err = 0;
+
+  // Levels in index order
+  lv[0] = EXPAND6(((src[0] << 3) | (src[1] >> 5)) & 63);
+  lv[1] = EXPAND6(((src[2] << 3) | (src[3] >> 5)) & 63);
+  lv[2] = (lv[0]*2 + lv[1]) / 3;
+  lv[3] = (lv[0] + lv[1]*2) / 3;
+
+  for (i = 0; i < 16; ++i) {
+    d = alpha[i] - lv[(mask >> (30 - i*2)) & 3];
+    err += d*d;
+  }
+
+  return err;
+}
+
+void CompressConstantAlpha(gct_u8 *dest, int a) {
+  // Alpha value is matched by index 2, like constant colors
+  WriteAlphaBlock(dest, AlphaMatch[a][0], AlphaMatch[a][1], 0xaaaaaaaa);
+}
@@ -0,0 +1,156 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  CMPR block compressor
+ *
+ ******************************************************************************/
+
+#ifndef _CMPR_H
+#define _CMPR_H
+
+#include "gct/gctlib.h"
+
+// Block compression and decoding kernels
+//
+// Index masks are in stb_dxt order (first pixel in the low bits),
+// every set of kernels must give the exact same results as the
+// scalar kernels so output doesn't depend on the CPU
+typedef struct cmpr_kernels_s {
+  // Pick initial endpoints along the principal axis of the block
+  void (*optimizeColors)(const gct_color_t *block,
+                         gct_u16 *max16, gct_u16 *min16);
+
+  // Match every pixel to the palette, color is 4 RGBA palette entries
+  gct_u32 (*matchColors)(const gct_color_t *block, const gct_u8 *color);
+
+  // Refine endpoints with least squares for the given indices,
+  // returns gct_true if the endpoints changed
+  gct_b32 (*refineBlock)(const gct_color_t *block, gct_u16 *max16,
+                         gct_u16 *min16, gct_u32 mask);
+
+  // Squared error of 16 alpha values against 4 alpha levels,
+  // each value is matched to the closest level
+  int (*alphaError)(const gct_u8 *alpha, const int *lv);
+
+  // Decode 8x8 supertile from its 4 color blocks and the 4 alpha
+  // blocks that go with them (32 bytes each), stride is in pixels
+  void (*decodeTile)(const gct_u8 *color, const gct_u8 *alpha,
+                     gct_iptr stride, gct_color_t *out);
+
+  // Decode only the 4 alpha blocks of a supertile into
+  // 8-bit alpha values, stride is in bytes
+  void (*decodeAlphaTile)(const gct_u8 *alpha, gct_iptr stride, gct_u8 *out);
+} cmpr_kernels_t;
+
+// SIMD kernels, only built when GCT_SIMD is defined
+extern const cmpr_kernels_t CMPRKernelsSSE2;
+extern const cmpr_kernels_t CMPRKernelsAVX2;
+
+// 16 alpha values fit in one SSE2 register, so the AVX2 kernels use this too
+int AlphaErrorSSE2(const gct_u8 *alpha, const int *lv);
+
+// Get palettes of the 4 color blocks and 4 alpha blocks of a supertile,
+// 4 entries per block. Color entries are RGBA with alpha left at 0, alpha
+// entries only have alpha set, so an entry of each can be ORed together.
+// Palettes of 4 blocks fit in one SSE2 register, so AVX2 uses this too
+void DecodePalettesSSE2(const gct_u8 *color, const gct_u8 *alpha,
+                        gct_u32 *pal, gct_u32 *apal);
+
+// Same as DecodePalettesSSE2 for alpha blocks only,
+// with alpha entries in the low byte of each entry
+void DecodeAlphaPalettesSSE2(const gct_u8 *alpha, gct_u32 *apal);
+
+// Add the RGB values of all 16 pixels of a color block to sums,
+// without decoding the pixels themselves
+void SumColorBlock(const gct_u8 *color, int *sums);
+
+// Add the RGBA values of all 16 pixels of a color block and an alpha
+// block to sums, without decoding the pixels themselves
+void SumBlockPixels(const gct_u8 *color, const gct_u8 *alpha, int *sums);
+
+// Add the alpha values of all 16 pixels of an alpha block to sum, and get
+// masks of visible (alpha > 0) and opaque pixels as from AlphaBlockMask
+void AnalyzeAlphaBlock(const gct_u8 *alpha, int *sum,
+                       gct_u32 *visible, gct_u32 *opaque);
+
+// Get mask of the pixels of an alpha block with alpha >= threshold,
+// 4 bits per row with row 0 and the first pixel of each row on top
+gct_u32 AlphaBlockMask(const gct_u8 *alpha, int threshold);
+
+// Get 1-bit mask of the alpha plane of a supertile, one byte per row
+// with the leftmost pixel in the top bit, set where alpha >= threshold
+void DecodeMaskTile(const gct_u8 *alpha, int threshold, gct_u8 *rows);
+
+// Get fastest kernels supported by the CPU
+const cmpr_kernels_t *GetCMPRKernels(void);
+
+// Compress 4x4 group of RGBA pixels into big-endian CMPR block,
+// alpha is ignored and blocks of a single color should
+// use CompressConstantColor instead
+void CompressColorBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                        const gct_color_t *block, gct_quality_t quality);
+
+// Same as CompressColorBlock, refining the endpoints of an earlier
+// compressed block instead of starting from PCA. prior can be dest
+void WarmColorBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                    const gct_color_t *block, gct_quality_t quality,
+                    const gct_u8 *prior);
+
+// Write CMPR block of a single color, without any search
+void CompressConstantColor(gct_u8 *dest, int r, int g, int b);
+
+// Get squared error of a compressed CMPR block against
+// the pixels it was compressed from, as the decoder sees it
+int ColorBlockError(const gct_u8 *src, const gct_color_t *block);
+
+// Compress 4x4 group of alpha values into big-endian CMPR block,
+// alpha is stored in the green channel of the block
+void CompressAlphaBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                        const gct_u8 *alpha, gct_quality_t quality);
+
+// Same as CompressAlphaBlock, also trying the endpoints of an earlier
+// compressed alpha block as a starting point. prior can be dest
+void WarmAlphaBlock(const cmpr_kernels_t *k, gct_u8 *dest,
+                    const gct_u8 *alpha, gct_quality_t quality,
+                    const gct_u8 *prior);
+
+// Write CMPR alpha block of a single alpha value, without any search
+void CompressConstantAlpha(gct_u8 *dest, int a);
+
+// Get squared error of a compressed CMPR alpha
+// block against the alpha values it was compressed from
+int AlphaBlockError(const gct_u8 *src, const gct_u8 *alpha);
+
+// Get endpoints with cluster fit, trying every split of the pixels
+// along the line between max16 and min16 into the 4 palette entries.
+// Only endpoints with a squared error below maxErr are looked for,
+// returns gct_false if none were found
+gct_b32 ClusterFit(const gct_color_t *block, gct_u16 *max16,
+                   gct_u16 *min16, int maxErr);
+
+// Scalar parts of the kernels, shared by every set of kernels
+
+// Convert 8-bit color to RGB565
+gct_u16 As565(int r, int g, int b);
+
+// Find principal axis of color distribution from covariance matrix
+// and channel ranges, scaled to integers
+void PrincipalAxis(const int *cov, const int *minc,
+                   const int *maxc, int *axis);
+
+// Get endpoints that best represent a single color
+void SingleColorEndpoints(int r, int g, int b,
+                          gct_u16 *max16, gct_u16 *min16);
+
+// Solve least squares system for endpoints
+//
+// at1: Sums of channels weighted by the max16 weight of each pixel
+// sum: Sums of channels
+// xx, yy, xy: Sums of squared/multiplied weights of each pixel
+void SolveEndpoints(const int *at1, const int *sum, int xx, int yy, int xy,
+                    gct_u16 *max16, gct_u16 *min16);
+
+#endif //_CMPR_H
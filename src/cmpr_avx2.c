@@ -0,0 +1,368 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  AVX2 CMPR block compression and decoding kernels
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "cmpr.h"
+
+#include <immintrin.h>
+
+// Block split into channels, 16-bit lanes, one pixel per lane
+typedef struct planar_s {
+  __m256i r, g, b;
+} planar_t;
+
+// Horizontal sum of 32-bit lanes
+static int HSum32(__m256i v) {
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+// Horizontal min/max of 16-bit lanes
+static int HMin16(__m256i v) {
+  __m128i s = _mm_min_epi16(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+
+  // minpos only works on unsigned values, channels are never negative
+  return _mm_cvtsi128_si32(_mm_minpos_epu16(s)) & 0xffff;
+}
+
+static int HMax16(__m256i v) {
+  __m128i s = _mm_max_epi16(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+
+  s = _mm_max_epi16(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_max_epi16(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  s = _mm_max_epi16(s, _mm_shufflelo_epi16(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_extract_epi16(s, 0);
+}
+
+// Broadcast minimum/maximum 32-bit lane to every lane
+static __m256i BroadcastMin32(__m256i v) {
+  v = _mm256_min_epi32(v, _mm256_permute2x128_si256(v, v, 0x01));
+  v = _mm256_min_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm256_min_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+static __m256i BroadcastMax32(__m256i v) {
+  v = _mm256_max_epi32(v, _mm256_permute2x128_si256(v, v, 0x01));
+  v = _mm256_max_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm256_max_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+// Get one bit per pixel from 2 registers of 32-bit masks
+static gct_u32 MoveMask16(__m256i lo, __m256i hi) {
+  return ((gct_u32)_mm256_movemask_ps(_mm256_castsi256_ps(lo))     ) |
+         ((gct_u32)_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8);
+}
+
+// Index of lowest set bit, mask must not be 0
+static int LowestBit(gct_u32 mask) {
+  int ret = 0;
+
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++ret;
+  }
+
+  return ret;
+}
+
+// Spread 16 bits out to every other bit of a 32-bit value
+static gct_u32 SpreadBits(gct_u32 x) {
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+// Pack 32-bit lanes of two registers to 16-bit lanes, keeping pixel order
+static __m256i Pack32(__m256i a, __m256i b) {
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+                                  _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+static void LoadPlanar(const gct_color_t *block, planar_t *p) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i a = _mm256_loadu_si256((const __m256i*)block);
+  const __m256i b = _mm256_loadu_si256((const __m256i*)(block + 8));
+
+  p->r = Pack32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+  p->g = Pack32(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask),
+                _mm256_and_si256(_mm256_srli_epi32(b, 8), mask));
+  p->b = Pack32(_mm256_and_si256(_mm256_srli_epi32(a, 16), mask),
+                _mm256_and_si256(_mm256_srli_epi32(b, 16), mask));
+}
+
+// Dot product of every pixel with vector,
+// lo holds pixels 0-7 and hi holds pixels 8-15
+static void DotBlock(const planar_t *p, int vr, int vg, int vb,
+                     __m256i *lo, __m256i *hi)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i rg = _mm256_set1_epi32((vg << 16) | (vr & 0xffff));
+  const __m256i b = _mm256_set1_epi32(vb & 0xffff);
+
+  // Unpacking works within 128-bit lanes, so a holds pixels 0-3 and 8-11,
+  // and b holds pixels 4-7 and 12-15
+  const __m256i da = _mm256_add_epi32(
+    _mm256_madd_epi16(_mm256_unpacklo_epi16(p->r, p->g), rg),
+    _mm256_madd_epi16(_mm256_unpacklo_epi16(p->b, zero), b));
+  const __m256i db = _mm256_add_epi32(
+    _mm256_madd_epi16(_mm256_unpackhi_epi16(p->r, p->g), rg),
+    _mm256_madd_epi16(_mm256_unpackhi_epi16(p->b, zero), b));
+
+  *lo = _mm256_permute2x128_si256(da, db, 0x20);
+  *hi = _mm256_permute2x128_si256(da, db, 0x31);
+}
+
+static __m256i SumLanes(__m256i c) {
+  return _mm256_madd_epi16(c, _mm256_set1_epi16(1));
+}
+
+static void OptimizeColorsAVX2(const gct_color_t *block,
+                               gct_u16 *max16, gct_u16 *min16)
+{
+  planar_t p;
+  __m256i d[3], lo, hi, mn, mx;
+  int mu[3], minc[3], maxc[3], cov[6], axis[3];
+  int ch, minp, maxp;
+  const __m256i *c[3];
+
+  LoadPlanar(block, &p);
+  c[0] = &p.r;
+  c[1] = &p.g;
+  c[2] = &p.b;
+
+  // Determine color distribution
+  for (ch = 0; ch < 3; ++ch) {
+    mu[ch] = (HSum32(SumLanes(*c[ch])) + 8) >> 4;
+    minc[ch] = HMin16(*c[ch]);
+    maxc[ch] = HMax16(*c[ch]);
+    d[ch] = _mm256_sub_epi16(*c[ch], _mm256_set1_epi16(mu[ch]));
+  }
+
+  // Determine covariance matrix
+  cov[0] = HSum32(_mm256_madd_epi16(d[0], d[0]));
+  cov[1] = HSum32(_mm256_madd_epi16(d[0], d[1]));
+  cov[2] = HSum32(_mm256_madd_epi16(d[0], d[2]));
+  cov[3] = HSum32(_mm256_madd_epi16(d[1], d[1]));
+  cov[4] = HSum32(_mm256_madd_epi16(d[1], d[2]));
+  cov[5] = HSum32(_mm256_madd_epi16(d[2], d[2]));
+
+  PrincipalAxis(cov, minc, maxc, axis);
+
+  // Pick colors at extreme points, first pixel wins ties
+  DotBlock(&p, axis[0], axis[1], axis[2], &lo, &hi);
+
+  mn = BroadcastMin32(_mm256_min_epi32(lo, hi));
+  mx = BroadcastMax32(_mm256_max_epi32(lo, hi));
+
+  minp = LowestBit(MoveMask16(_mm256_cmpeq_epi32(lo, mn),
+                              _mm256_cmpeq_epi32(hi, mn)));
+  maxp = LowestBit(MoveMask16(_mm256_cmpeq_epi32(lo, mx),
+                              _mm256_cmpeq_epi32(hi, mx)));
+
+  *max16 = As565(block[maxp].r, block[maxp].g, block[maxp].b);
+  *min16 = As565(block[minp].r, block[minp].g, block[minp].b);
+}
+
+static gct_u32 MatchColorsAVX2(const gct_color_t *block, const gct_u8 *color) {
+  planar_t p;
+  __m256i dots[2], bit0[2], bit1[2];
+  int stops[4];
+  int i;
+  const int dirr = color[0*4+0] - color[1*4+0];
+  const int dirg = color[0*4+1] - color[1*4+1];
+  const int dirb = color[0*4+2] - color[1*4+2];
+  __m256i c0Point, halfPoint, c3Point;
+
+  LoadPlanar(block, &p);
+  DotBlock(&p, dirr, dirg, dirb, dots, dots+1);
+
+  for (i = 0; i < 4; ++i)
+    stops[i] = color[i*4+0]*dirr + color[i*4+1]*dirg + color[i*4+2]*dirb;
+
+  // Same 1D crossover points as stb__MatchColorsBlock
+  c0Point = _mm256_set1_epi32(stops[1] + stops[3]);
+  halfPoint = _mm256_set1_epi32(stops[3] + stops[2]);
+  c3Point = _mm256_set1_epi32(stops[2] + stops[0]);
+
+  // Below half point: 1 or 3, otherwise 2 or 0
+  for (i = 0; i < 2; ++i) {
+    const __m256i dot = _mm256_slli_epi32(dots[i], 1);
+    const __m256i half = _mm256_cmpgt_epi32(halfPoint, dot);
+
+    bit0[i] = half;
+    bit1[i] = _mm256_or_si256(
+      _mm256_andnot_si256(_mm256_cmpgt_epi32(c0Point, dot), half),
+      _mm256_andnot_si256(half, _mm256_cmpgt_epi32(c3Point, dot)));
+  }
+
+  return SpreadBits(MoveMask16(bit0[0], bit0[1])) |
+    (SpreadBits(MoveMask16(bit1[0], bit1[1])) << 1);
+}
+
+// Get index of each pixel from mask, 16-bit lanes
+static __m256i UnpackIndices(gct_u32 mask) {
+  // Shift each index to the top of its lane
+  const __m256i shift = _mm256_set_epi16(1<<0, 1<<2, 1<<4, 1<<6,
+                                         1<<8, 1<<10, 1<<12, 1<<14,
+                                         1<<0, 1<<2, 1<<4, 1<<6,
+                                         1<<8, 1<<10, 1<<12, 1<<14);
+  const __m256i m = _mm256_inserti128_si256(
+    _mm256_castsi128_si256(_mm_set1_epi16((short)mask)),
+    _mm_set1_epi16((short)(mask >> 16)), 1);
+
+  return _mm256_srli_epi16(_mm256_mullo_epi16(m, shift), 14);
+}
+
+static gct_b32 RefineBlockAVX2(const gct_color_t *block, gct_u16 *max16,
+                               gct_u16 *min16, gct_u32 mask)
+{
+  planar_t p;
+  int sum[3], at1[3];
+  const gct_u16 oldMin = *min16, oldMax = *max16;
+
+  LoadPlanar(block, &p);
+
+  sum[0] = HSum32(SumLanes(p.r));
+  sum[1] = HSum32(SumLanes(p.g));
+  sum[2] = HSum32(SumLanes(p.b));
+
+  if ((mask ^ (mask<<2)) < 4) {
+    // All pixels have the same index, linear system would be singular;
+    // solve using optimal single-color match on average color
+    SingleColorEndpoints((sum[0]+8) >> 4, (sum[1]+8) >> 4,
+                         (sum[2]+8) >> 4, max16, min16);
+  } else {
+    // Weight of max16 for each index is 3, 0, 2, 1
+    const __m256i idx = UnpackIndices(mask);
+    const __m256i w1 = _mm256_or_si256(
+      _mm256_and_si256(_mm256_cmpeq_epi16(idx, _mm256_setzero_si256()),
+                       _mm256_set1_epi16(3)),
+      _mm256_or_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi16(idx, _mm256_set1_epi16(2)),
+                         _mm256_set1_epi16(2)),
+        _mm256_and_si256(_mm256_cmpeq_epi16(idx, _mm256_set1_epi16(3)),
+                         _mm256_set1_epi16(1))));
+    const __m256i w2 = _mm256_sub_epi16(_mm256_set1_epi16(3), w1);
+
+    at1[0] = HSum32(_mm256_madd_epi16(w1, p.r));
+    at1[1] = HSum32(_mm256_madd_epi16(w1, p.g));
+    at1[2] = HSum32(_mm256_madd_epi16(w1, p.b));
+
+    SolveEndpoints(at1, sum, HSum32(_mm256_madd_epi16(w1, w1)),
+                   HSum32(_mm256_madd_epi16(w2, w2)),
+                   HSum32(_mm256_madd_epi16(w1, w2)),
+                   max16, min16);
+  }
+
+  return oldMin != *min16 || oldMax != *max16;
+}
+
+static void DecodeTileAVX2(const gct_u8 *color, const gct_u8 *alpha,
+                           gct_iptr stride, gct_color_t *out)
+{
+  // Entries of the left block are in lanes 0-3, right block in 4-7
+  const __m256i right = _mm256_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m256i c = _mm256_loadu_si256((const __m256i*)color);
+  const __m256i a = _mm256_loadu_si256((const __m256i*)alpha);
+  gct_u32 pal[16], apal[16];
+  __m256i p, ap, t, at, shift, idx, aidx;
+  int i, r;
+
+  DecodePalettesSSE2(color, alpha, pal, apal);
+
+  for (i = 0; i < 2; ++i, out += stride*4) {
+    p = _mm256_loadu_si256((const __m256i*)(pal + i*8));
+    ap = _mm256_loadu_si256((const __m256i*)(apal + i*8));
+
+    // Index tables of the left and right blocks in their lanes,
+    // tables are the second 32-bit half of each block
+    idx = _mm256_add_epi32(_mm256_set1_epi32(i*4 + 1),
+                           _mm256_srli_epi32(right, 1));
+    t = _mm256_permutevar8x32_epi32(c, idx);
+    at = _mm256_permutevar8x32_epi32(a, idx);
+
+    // Row r of a block is byte r of its table, pixel 0 in the top bits
+    shift = _mm256_setr_epi32(6, 4, 2, 0, 6, 4, 2, 0);
+    for (r = 0; r < 4; ++r) {
+      idx = _mm256_or_si256(
+        _mm256_and_si256(_mm256_srlv_epi32(t, shift), three), right);
+      aidx = _mm256_or_si256(
+        _mm256_and_si256(_mm256_srlv_epi32(at, shift), three), right);
+      shift = _mm256_add_epi32(shift, _mm256_set1_epi32(8));
+
+      // Full 8-pixel row of the supertile
+      _mm256_storeu_si256((__m256i*)(out + r*stride), _mm256_or_si256(
+        _mm256_permutevar8x32_epi32(p, idx),
+        _mm256_permutevar8x32_epi32(ap, aidx)));
+    }
+  }
+}
+
+static void DecodeAlphaTileAVX2(const gct_u8 *alpha, gct_iptr stride,
+                                gct_u8 *out)
+{
+  // Entries of the left block are in lanes 0-3, right block in 4-7
+  const __m256i right = _mm256_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m256i a = _mm256_loadu_si256((const __m256i*)alpha);
+
+  // After packing, each 128-bit lane has 4 rows of one block
+  const __m256i interleave = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  gct_u32 apal[16];
+  __m256i ap, at, shift, idx, rows[4], packed;
+  int i, r;
+
+  DecodeAlphaPalettesSSE2(alpha, apal);
+
+  for (i = 0; i < 2; ++i, out += stride*4) {
+    ap = _mm256_loadu_si256((const __m256i*)(apal + i*8));
+    idx = _mm256_add_epi32(_mm256_set1_epi32(i*4 + 1),
+                           _mm256_srli_epi32(right, 1));
+    at = _mm256_permutevar8x32_epi32(a, idx);
+
+    shift = _mm256_setr_epi32(6, 4, 2, 0, 6, 4, 2, 0);
+    for (r = 0; r < 4; ++r) {
+      idx = _mm256_or_si256(
+        _mm256_and_si256(_mm256_srlv_epi32(at, shift), three), right);
+      shift = _mm256_add_epi32(shift, _mm256_set1_epi32(8));
+      rows[r] = _mm256_permutevar8x32_epi32(ap, idx);
+    }
+
+    // 4 full 8-pixel rows of the supertile
+    packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(
+      _mm256_packus_epi32(rows[0], rows[1]),
+      _mm256_packus_epi32(rows[2], rows[3])), interleave);
+    _mm_storel_epi64((__m128i*)out, _mm256_castsi256_si128(packed));
+    _mm_storel_epi64((__m128i*)(out + stride), _mm_srli_si128(
+      _mm256_castsi256_si128(packed), 8));
+    _mm_storel_epi64((__m128i*)(out + stride*2),
+                     _mm256_extracti128_si256(packed, 1));
+    _mm_storel_epi64((__m128i*)(out + stride*3), _mm_srli_si128(
+      _mm256_extracti128_si256(packed, 1), 8));
+  }
+}
+
+const cmpr_kernels_t CMPRKernelsAVX2 = {
+  OptimizeColorsAVX2,
+  MatchColorsAVX2,
+  RefineBlockAVX2,
+  AlphaErrorSSE2,
+  DecodeTileAVX2,
+  DecodeAlphaTileAVX2
+};
@@ -0,0 +1,525 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  SSE2 CMPR block compression and decoding kernels
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "cmpr.h"
+
+#include <emmintrin.h>
+
+// Block split into channels, 16-bit lanes,
+// index 0 holds pixels 0-7, index 1 holds pixels 8-15
+typedef struct planar_s {
+  __m128i r[2], g[2], b[2];
+} planar_t;
+
+// Horizontal sum of 32-bit lanes
+static int HSum32(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+// Horizontal min/max of 16-bit lanes
+static int HMin16(__m128i v) {
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_extract_epi16(v, 0);
+}
+
+static int HMax16(__m128i v) {
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_max_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_extract_epi16(v, 0);
+}
+
+// Signed 32-bit min/max, SSE2 only has them for 16-bit lanes
+static __m128i Min32(__m128i a, __m128i b) {
+  const __m128i lt = _mm_cmplt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+}
+
+static __m128i Max32(__m128i a, __m128i b) {
+  const __m128i gt = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+// Get one bit per pixel from 4 registers of 32-bit masks
+static gct_u32 MoveMask16(const __m128i *m) {
+  return ((gct_u32)_mm_movemask_ps(_mm_castsi128_ps(m[0]))      ) |
+         ((gct_u32)_mm_movemask_ps(_mm_castsi128_ps(m[1])) <<  4) |
+         ((gct_u32)_mm_movemask_ps(_mm_castsi128_ps(m[2])) <<  8) |
+         ((gct_u32)_mm_movemask_ps(_mm_castsi128_ps(m[3])) << 12);
+}
+
+// Index of lowest set bit, mask must not be 0
+static int LowestBit(gct_u32 mask) {
+  int ret = 0;
+
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++ret;
+  }
+
+  return ret;
+}
+
+// Spread 16 bits out to every other bit of a 32-bit value
+static gct_u32 SpreadBits(gct_u32 x) {
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+static void LoadPlanar(const gct_color_t *block, planar_t *p) {
+  const __m128i mask = _mm_set1_epi32(0xff);
+  __m128i px[4];
+  int i;
+
+  for (i = 0; i < 4; ++i)
+    px[i] = _mm_loadu_si128((const __m128i*)(block + i*4));
+
+  for (i = 0; i < 2; ++i) {
+    const __m128i a = px[i*2], b = px[i*2+1];
+
+    p->r[i] = _mm_packs_epi32(_mm_and_si128(a, mask),
+                              _mm_and_si128(b, mask));
+    p->g[i] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask),
+                              _mm_and_si128(_mm_srli_epi32(b, 8), mask));
+    p->b[i] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask),
+                              _mm_and_si128(_mm_srli_epi32(b, 16), mask));
+  }
+}
+
+// Dot product of every pixel with vector, dots[i] holds pixels i*4 to i*4+3
+static void DotBlock(const planar_t *p, int vr, int vg, int vb, __m128i *dots) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rg = _mm_set1_epi32((vg << 16) | (vr & 0xffff));
+  const __m128i b = _mm_set1_epi32(vb & 0xffff);
+  int i;
+
+  for (i = 0; i < 2; ++i) {
+    dots[i*2] = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpacklo_epi16(p->r[i], p->g[i]), rg),
+      _mm_madd_epi16(_mm_unpacklo_epi16(p->b[i], zero), b));
+    dots[i*2+1] = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpackhi_epi16(p->r[i], p->g[i]), rg),
+      _mm_madd_epi16(_mm_unpackhi_epi16(p->b[i], zero), b));
+  }
+}
+
+// Channel sums, 32-bit lanes
+static __m128i SumPairs(const __m128i *c) {
+  const __m128i ones = _mm_set1_epi16(1);
+  return _mm_add_epi32(_mm_madd_epi16(c[0], ones), _mm_madd_epi16(c[1], ones));
+}
+
+static __m128i MulPairs(const __m128i *a, const __m128i *b) {
+  return _mm_add_epi32(_mm_madd_epi16(a[0], b[0]), _mm_madd_epi16(a[1], b[1]));
+}
+
+static void OptimizeColorsSSE2(const gct_color_t *block,
+                               gct_u16 *max16, gct_u16 *min16)
+{
+  planar_t p;
+  __m128i d[3][2], dots[4], eqMin[4], eqMax[4], mn, mx;
+  int mu[3], minc[3], maxc[3], cov[6], axis[3];
+  int ch, i, minp, maxp;
+  const __m128i *c[3];
+
+  LoadPlanar(block, &p);
+  c[0] = p.r;
+  c[1] = p.g;
+  c[2] = p.b;
+
+  // Determine color distribution
+  for (ch = 0; ch < 3; ++ch) {
+    __m128i m;
+
+    mu[ch] = (HSum32(SumPairs(c[ch])) + 8) >> 4;
+    minc[ch] = HMin16(_mm_min_epi16(c[ch][0], c[ch][1]));
+    maxc[ch] = HMax16(_mm_max_epi16(c[ch][0], c[ch][1]));
+
+    m = _mm_set1_epi16(mu[ch]);
+    d[ch][0] = _mm_sub_epi16(c[ch][0], m);
+    d[ch][1] = _mm_sub_epi16(c[ch][1], m);
+  }
+
+  // Determine covariance matrix
+  cov[0] = HSum32(MulPairs(d[0], d[0]));
+  cov[1] = HSum32(MulPairs(d[0], d[1]));
+  cov[2] = HSum32(MulPairs(d[0], d[2]));
+  cov[3] = HSum32(MulPairs(d[1], d[1]));
+  cov[4] = HSum32(MulPairs(d[1], d[2]));
+  cov[5] = HSum32(MulPairs(d[2], d[2]));
+
+  PrincipalAxis(cov, minc, maxc, axis);
+
+  // Pick colors at extreme points, first pixel wins ties
+  DotBlock(&p, axis[0], axis[1], axis[2], dots);
+
+  mn = Min32(Min32(dots[0], dots[1]), Min32(dots[2], dots[3]));
+  mn = Min32(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+  mn = Min32(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+  mx = Max32(Max32(dots[0], dots[1]), Max32(dots[2], dots[3]));
+  mx = Max32(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+  mx = Max32(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  for (i = 0; i < 4; ++i) {
+    eqMin[i] = _mm_cmpeq_epi32(dots[i], mn);
+    eqMax[i] = _mm_cmpeq_epi32(dots[i], mx);
+  }
+
+  minp = LowestBit(MoveMask16(eqMin));
+  maxp = LowestBit(MoveMask16(eqMax));
+
+  *max16 = As565(block[maxp].r, block[maxp].g, block[maxp].b);
+  *min16 = As565(block[minp].r, block[minp].g, block[minp].b);
+}
+
+static gct_u32 MatchColorsSSE2(const gct_color_t *block, const gct_u8 *color) {
+  planar_t p;
+  __m128i dots[4], bit0[4], bit1[4];
+  int stops[4];
+  int i;
+  const int dirr = color[0*4+0] - color[1*4+0];
+  const int dirg = color[0*4+1] - color[1*4+1];
+  const int dirb = color[0*4+2] - color[1*4+2];
+  __m128i c0Point, halfPoint, c3Point;
+
+  LoadPlanar(block, &p);
+  DotBlock(&p, dirr, dirg, dirb, dots);
+
+  for (i = 0; i < 4; ++i)
+    stops[i] = color[i*4+0]*dirr + color[i*4+1]*dirg + color[i*4+2]*dirb;
+
+  // Same 1D crossover points as stb__MatchColorsBlock
+  c0Point = _mm_set1_epi32(stops[1] + stops[3]);
+  halfPoint = _mm_set1_epi32(stops[3] + stops[2]);
+  c3Point = _mm_set1_epi32(stops[2] + stops[0]);
+
+  // Below half point: 1 or 3, otherwise 2 or 0
+  for (i = 0; i < 4; ++i) {
+    const __m128i dot = _mm_slli_epi32(dots[i], 1);
+    const __m128i half = _mm_cmplt_epi32(dot, halfPoint);
+
+    bit0[i] = half;
+    bit1[i] = _mm_or_si128(_mm_andnot_si128(_mm_cmplt_epi32(dot, c0Point), half),
+                           _mm_andnot_si128(half, _mm_cmplt_epi32(dot, c3Point)));
+  }
+
+  return SpreadBits(MoveMask16(bit0)) | (SpreadBits(MoveMask16(bit1)) << 1);
+}
+
+// Get index of each pixel from mask, 16-bit lanes
+static __m128i UnpackIndices(gct_u32 mask) {
+  // Shift each index to the top of its lane
+  const __m128i shift = _mm_set_epi16(1<<0, 1<<2, 1<<4, 1<<6,
+                                      1<<8, 1<<10, 1<<12, 1<<14);
+  return _mm_srli_epi16(_mm_mullo_epi16(_mm_set1_epi16((short)mask), shift), 14);
+}
+
+static gct_b32 RefineBlockSSE2(const gct_color_t *block, gct_u16 *max16,
+                               gct_u16 *min16, gct_u32 mask)
+{
+  planar_t p;
+  __m128i w1[2], w2[2];
+  int sum[3], at1[3];
+  int i;
+  const gct_u16 oldMin = *min16, oldMax = *max16;
+
+  LoadPlanar(block, &p);
+
+  sum[0] = HSum32(SumPairs(p.r));
+  sum[1] = HSum32(SumPairs(p.g));
+  sum[2] = HSum32(SumPairs(p.b));
+
+  if ((mask ^ (mask<<2)) < 4) {
+    // All pixels have the same index, linear system would be singular;
+    // solve using optimal single-color match on average color
+    SingleColorEndpoints((sum[0]+8) >> 4, (sum[1]+8) >> 4,
+                         (sum[2]+8) >> 4, max16, min16);
+  } else {
+    // Weight of max16 for each index is 3, 0, 2, 1
+    for (i = 0; i < 2; ++i) {
+      const __m128i idx = UnpackIndices(mask >> (i*16));
+
+      w1[i] = _mm_or_si128(
+        _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_setzero_si128()), _mm_set1_epi16(3)),
+        _mm_or_si128(
+          _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_set1_epi16(2)), _mm_set1_epi16(2)),
+          _mm_and_si128(_mm_cmpeq_epi16(idx, _mm_set1_epi16(3)), _mm_set1_epi16(1))));
+      w2[i] = _mm_sub_epi16(_mm_set1_epi16(3), w1[i]);
+    }
+
+    at1[0] = HSum32(MulPairs(w1, p.r));
+    at1[1] = HSum32(MulPairs(w1, p.g));
+    at1[2] = HSum32(MulPairs(w1, p.b));
+
+    SolveEndpoints(at1, sum, HSum32(MulPairs(w1, w1)),
+                   HSum32(MulPairs(w2, w2)), HSum32(MulPairs(w1, w2)),
+                   max16, min16);
+  }
+
+  return oldMin != *min16 || oldMax != *max16;
+}
+
+int AlphaErrorSSE2(const gct_u8 *alpha, const int *lv) {
+  const __m128i a = _mm_loadu_si128((const __m128i*)alpha);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i l, d, dist;
+  int i;
+
+  // Distance to the closest level, in 8-bit lanes
+  dist = _mm_set1_epi8(-1);
+  for (i = 0; i < 4; ++i) {
+    l = _mm_set1_epi8((char)lv[i]);
+    d = _mm_or_si128(_mm_subs_epu8(a, l), _mm_subs_epu8(l, a));
+    dist = _mm_min_epu8(dist, d);
+  }
+
+  // Square and sum distances
+  d = _mm_unpacklo_epi8(dist, zero);
+  dist = _mm_unpackhi_epi8(dist, zero);
+  return HSum32(_mm_add_epi32(_mm_madd_epi16(d, d),
+                              _mm_madd_epi16(dist, dist)));
+}
+
+// Expand 8-bit channel of 16-bit lanes from its top 5 or 6 bits
+static __m128i Expand5(__m128i c) {
+  return _mm_or_si128(_mm_slli_epi16(c, 3), _mm_srli_epi16(c, 2));
+}
+
+static __m128i Expand6(__m128i c) {
+  return _mm_or_si128(_mm_slli_epi16(c, 2), _mm_srli_epi16(c, 4));
+}
+
+// Lanes hold pairs of endpoints, get (2*e0 + e1) / 3 in the first
+// lane of each pair and (e0 + 2*e1) / 3 in the second one. Pairs where
+// four isn't set are in 3 color mode, and get (e0 + e1) / 2 then 0
+static __m128i Interpolate(__m128i e, __m128i four) {
+  const __m128i swapped = _mm_shufflehi_epi16(
+    _mm_shufflelo_epi16(e, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+  const __m128i sum = _mm_add_epi16(_mm_slli_epi16(e, 1), swapped);
+
+  // x*0xaaab >> 17 is x/3 for every 16-bit x
+  const __m128i thirds = _mm_srli_epi16(
+    _mm_mulhi_epu16(sum, _mm_set1_epi16((short)0xaaab)), 1);
+  const __m128i half = _mm_and_si128(
+    _mm_srli_epi16(_mm_add_epi16(e, swapped), 1), _mm_set1_epi32(0xffff));
+
+  return _mm_or_si128(_mm_and_si128(four, thirds),
+                      _mm_andnot_si128(four, half));
+}
+
+// Get mask of the pairs of endpoints in 4 color mode,
+// where the first endpoint is above the second one
+static __m128i FourColorMode(__m128i ends) {
+  const __m128i bias = _mm_set1_epi16((short)0x8000);
+  const __m128i e = _mm_xor_si128(ends, bias);
+  const __m128i swapped = _mm_shufflehi_epi16(
+    _mm_shufflelo_epi16(e, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+  const __m128i gt = _mm_cmpgt_epi16(e, swapped);
+
+  // Result of the first lane of each pair goes in both lanes
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(gt, _MM_SHUFFLE(2, 2, 0, 0)),
+                             _MM_SHUFFLE(2, 2, 0, 0));
+}
+
+// Split 4 blocks into their endpoints (16-bit lanes, two per block)
+// and index tables (32-bit lanes, as stored)
+static void LoadBlocks(const gct_u8 *src, __m128i *ends, __m128i *tables) {
+  const __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)src),
+                                      _MM_SHUFFLE(3, 1, 2, 0));
+  const __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(src+16)),
+                                      _MM_SHUFFLE(3, 1, 2, 0));
+  const __m128i e = _mm_unpacklo_epi64(a, b);
+
+  *ends = _mm_or_si128(_mm_slli_epi16(e, 8), _mm_srli_epi16(e, 8));
+  *tables = _mm_unpackhi_epi64(a, b);
+}
+
+// Get palettes of 4 color blocks and 4 alpha blocks, 4 RGBA entries
+// per palette with alpha left at 0, and 4 alpha entries in the top
+// byte of each lane for alpha palettes. Blocks can be in either mode
+static void DecodePalettes(__m128i colorEnds, __m128i alphaEnds,
+                           __m128i *pal, __m128i *apal)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i r = Expand5(_mm_srli_epi16(colorEnds, 11));
+  const __m128i g = Expand6(_mm_and_si128(_mm_srli_epi16(colorEnds, 5),
+                                          _mm_set1_epi16(63)));
+  const __m128i b = Expand5(_mm_and_si128(colorEnds, _mm_set1_epi16(31)));
+  const __m128i a = Expand6(_mm_and_si128(_mm_srli_epi16(alphaEnds, 5),
+                                          _mm_set1_epi16(63)));
+  const __m128i four = FourColorMode(colorEnds);
+  const __m128i afour = FourColorMode(alphaEnds);
+  const __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+  const __m128i rg3 = _mm_or_si128(Interpolate(r, four),
+                                   _mm_slli_epi16(Interpolate(g, four), 8));
+  const __m128i b3 = Interpolate(b, four);
+  const __m128i a8 = _mm_slli_epi16(a, 8);
+  const __m128i a38 = _mm_slli_epi16(Interpolate(a, afour), 8);
+  __m128i e, t;
+
+  // Endpoints of blocks 0-1, then 2-3, entries 2-3 are the thirds
+  e = _mm_unpacklo_epi16(rg, b);
+  t = _mm_unpacklo_epi16(rg3, b3);
+  pal[0] = _mm_unpacklo_epi64(e, t);
+  pal[1] = _mm_unpackhi_epi64(e, t);
+  e = _mm_unpackhi_epi16(rg, b);
+  t = _mm_unpackhi_epi16(rg3, b3);
+  pal[2] = _mm_unpacklo_epi64(e, t);
+  pal[3] = _mm_unpackhi_epi64(e, t);
+
+  e = _mm_unpacklo_epi16(zero, a8);
+  t = _mm_unpacklo_epi16(zero, a38);
+  apal[0] = _mm_unpacklo_epi64(e, t);
+  apal[1] = _mm_unpackhi_epi64(e, t);
+  e = _mm_unpackhi_epi16(zero, a8);
+  t = _mm_unpackhi_epi16(zero, a38);
+  apal[2] = _mm_unpacklo_epi64(e, t);
+  apal[3] = _mm_unpackhi_epi64(e, t);
+}
+
+// Look up palette entries of 4 pixels, table holds the index table
+// in every lane, and hi/lo select the bits of each pixel
+static __m128i LookUp4(__m128i pal, __m128i table, __m128i hi, __m128i lo) {
+  const __m128i h = _mm_cmpeq_epi32(_mm_and_si128(table, hi), hi);
+  const __m128i l = _mm_cmpeq_epi32(_mm_and_si128(table, lo), lo);
+  const __m128i p01 = _mm_or_si128(
+    _mm_and_si128(l, _mm_shuffle_epi32(pal, 0x55)),
+    _mm_andnot_si128(l, _mm_shuffle_epi32(pal, 0x00)));
+  const __m128i p23 = _mm_or_si128(
+    _mm_and_si128(l, _mm_shuffle_epi32(pal, 0xff)),
+    _mm_andnot_si128(l, _mm_shuffle_epi32(pal, 0xaa)));
+
+  return _mm_or_si128(_mm_and_si128(h, p23), _mm_andnot_si128(h, p01));
+}
+
+void DecodePalettesSSE2(const gct_u8 *color, const gct_u8 *alpha,
+                        gct_u32 *pal, gct_u32 *apal)
+{
+  __m128i colorEnds, alphaEnds, tables, p[4], ap[4];
+  int i;
+
+  LoadBlocks(color, &colorEnds, &tables);
+  LoadBlocks(alpha, &alphaEnds, &tables);
+  DecodePalettes(colorEnds, alphaEnds, p, ap);
+
+  for (i = 0; i < 4; ++i) {
+    _mm_storeu_si128((__m128i*)(pal + i*4), p[i]);
+    _mm_storeu_si128((__m128i*)(apal + i*4), ap[i]);
+  }
+}
+
+static void DecodeTileSSE2(const gct_u8 *color, const gct_u8 *alpha,
+                           gct_iptr stride, gct_color_t *out)
+{
+  __m128i colorEnds, alphaEnds, tables, atables, pal[4], apal[4];
+  __m128i t, at, hi, lo;
+  gct_color_t *row;
+  int i, r;
+
+  LoadBlocks(color, &colorEnds, &tables);
+  LoadBlocks(alpha, &alphaEnds, &atables);
+  DecodePalettes(colorEnds, alphaEnds, pal, apal);
+
+  for (i = 0; i < 4; ++i) {
+    t = _mm_set1_epi32(_mm_cvtsi128_si32(tables));
+    at = _mm_set1_epi32(_mm_cvtsi128_si32(atables));
+    tables = _mm_srli_si128(tables, 4);
+    atables = _mm_srli_si128(atables, 4);
+    row = out + (i >> 1)*4*stride + (i & 1)*4;
+
+    // Row r of a block is byte r of its table, pixel 0 in the top bits
+    hi = _mm_setr_epi32(0x80, 0x20, 0x08, 0x02);
+    for (r = 0; r < 4; ++r, row += stride, hi = _mm_slli_epi32(hi, 8)) {
+      lo = _mm_srli_epi32(hi, 1);
+      _mm_storeu_si128((__m128i*)row,
+                       _mm_or_si128(LookUp4(pal[i], t, hi, lo),
+                                    LookUp4(apal[i], at, hi, lo)));
+    }
+  }
+}
+
+// Get palettes of 4 alpha blocks, 4 alpha entries
+// per palette in the low byte of each lane
+static void DecodeAlphaPalettes(__m128i alphaEnds, __m128i *apal) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i a = Expand6(_mm_and_si128(_mm_srli_epi16(alphaEnds, 5),
+                                          _mm_set1_epi16(63)));
+  const __m128i a3 = Interpolate(a, FourColorMode(alphaEnds));
+  __m128i e, t;
+
+  e = _mm_unpacklo_epi16(a, zero);
+  t = _mm_unpacklo_epi16(a3, zero);
+  apal[0] = _mm_unpacklo_epi64(e, t);
+  apal[1] = _mm_unpackhi_epi64(e, t);
+  e = _mm_unpackhi_epi16(a, zero);
+  t = _mm_unpackhi_epi16(a3, zero);
+  apal[2] = _mm_unpacklo_epi64(e, t);
+  apal[3] = _mm_unpackhi_epi64(e, t);
+}
+
+void DecodeAlphaPalettesSSE2(const gct_u8 *alpha, gct_u32 *apal) {
+  __m128i alphaEnds, atables, ap[4];
+  int i;
+
+  LoadBlocks(alpha, &alphaEnds, &atables);
+  DecodeAlphaPalettes(alphaEnds, ap);
+
+  for (i = 0; i < 4; ++i)
+    _mm_storeu_si128((__m128i*)(apal + i*4), ap[i]);
+}
+
+static void DecodeAlphaTileSSE2(const gct_u8 *alpha, gct_iptr stride,
+                                gct_u8 *out)
+{
+  __m128i alphaEnds, atables, apal[4], left, right, hi, lo, rows[2], packed;
+  int i, r;
+
+  LoadBlocks(alpha, &alphaEnds, &atables);
+  DecodeAlphaPalettes(alphaEnds, apal);
+
+  // Left and right blocks make up full 8-pixel rows
+  for (i = 0; i < 4; i += 2, out += stride*4) {
+    left = _mm_set1_epi32(_mm_cvtsi128_si32(atables));
+    right = _mm_set1_epi32(_mm_cvtsi128_si32(_mm_srli_si128(atables, 4)));
+    atables = _mm_srli_si128(atables, 8);
+
+    hi = _mm_setr_epi32(0x80, 0x20, 0x08, 0x02);
+    for (r = 0; r < 4; ++r, hi = _mm_slli_epi32(hi, 8)) {
+      lo = _mm_srli_epi32(hi, 1);
+      rows[r & 1] = _mm_packs_epi32(LookUp4(apal[i], left, hi, lo),
+                                    LookUp4(apal[i+1], right, hi, lo));
+
+      // Two rows are packed into bytes at once
+      if (r & 1) {
+        packed = _mm_packus_epi16(rows[0], rows[1]);
+        _mm_storel_epi64((__m128i*)(out + (r-1)*stride), packed);
+        _mm_storel_epi64((__m128i*)(out + r*stride),
+                         _mm_srli_si128(packed, 8));
+      }
+    }
+  }
+}
+
+const cmpr_kernels_t CMPRKernelsSSE2 = {
+  OptimizeColorsSSE2,
+  MatchColorsSSE2,
+  RefineBlockSSE2,
+  AlphaErrorSSE2,
+  DecodeTileSSE2,
+  DecodeAlphaTileSSE2
+};
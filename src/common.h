@@ -19,4 +19,28 @@ gct_b32 ValidImageSize(gct_i32 width, gct_i32 height);
 // Check if GCT image flags are supported
 gct_b32 SupportedImageFlags(gct_hdr_flags_t flags);
 
+// Check header of a GCT file, and get the size of the image
+gct_error_t ReadImageHeader(const gct_header_t *hdr,
+                            gct_i32 *width, gct_i32 *height);
+
+// Check if rows of an image are stored bottom-up,
+// based on the orientation field of its header
+gct_b32 ImageFlipped(const gct_header_t *hdr);
+
+// Flip CMPR block upside down by reversing the rows of
+// its index table, dest can be the same block as src
+void FlipBlock(gct_u8 *dest, const gct_u8 *src);
+
+// Get size in bytes of a pixel the decoder can write,
+// returns 0 if the decoder can't write the format
+int DecodedPixelSize(gct_pixel_format_t format);
+
+// Write row of decoded pixels in the output format
+void ConvertRow(const gct_color_t *src, gct_u8 *dest,
+                gct_i32 count, gct_pixel_format_t format);
+
+// 2-bit indices of every byte in reverse order. CMPR blocks have the
+// first pixel of each row in the top bits, BC1 blocks in the low bits
+extern const gct_u8 ReverseIndices[256];
+
 #endif //_COMMON_H
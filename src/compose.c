@@ -0,0 +1,181 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Lossless crops and atlases
+ *  Supertiles are independent of each other, so regions on 8-pixel
+ *  boundaries are moved around by copying their blocks as they are
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "common.h"
+#include "cmpr.h"
+
+#include <string.h>
+
+// Supertiles of an image
+typedef struct tiles_s {
+  // Color and alpha planes, only written to in the output image
+  gct_u8 *color, *alpha;
+
+  // Size in supertiles
+  gct_i32 tilesX, tilesY;
+
+  // Supertile rows are stored bottom-up
+  gct_b32 flipped;
+} tiles_t;
+
+// Set up supertiles of an image from its header and planes
+static void InitTiles(tiles_t *tiles, const gct_header_t *hdr,
+                      gct_i32 width, gct_i32 height, const void *planes)
+{
+  tiles->color = (gct_u8*)planes;
+  tiles->alpha = tiles->color + ((width*height) >> 1);
+  tiles->tilesX = width >> 3;
+  tiles->tilesY = height >> 3;
+  tiles->flipped = ImageFlipped(hdr);
+}
+
+// Get the stored row of an upright row of supertiles
+static gct_i32 StoredRow(const tiles_t *tiles, gct_i32 y) {
+  return tiles->flipped ? tiles->tilesY - 1 - y : y;
+}
+
+// Flip supertile upside down. Bottom blocks become top blocks,
+// and rows of each block are swapped
+static void FlipTile(gct_u8 *dest, const gct_u8 *src) {
+  int i;
+
+  for (i = 0; i < 4; ++i)
+    FlipBlock(dest + i*8, src + (i ^ 2)*8);
+}
+
+// Copy width x height supertiles at (sx, sy) of src to (dx, dy) of dest,
+// in upright supertile coordinates
+static void CopyTiles(const tiles_t *dest, gct_i32 dx, gct_i32 dy,
+                      const tiles_t *src, gct_i32 sx, gct_i32 sy,
+                      gct_i32 width, gct_i32 height)
+{
+  const gct_b32 flip = src->flipped != dest->flipped;
+  gct_iptr srcOffset, destOffset;
+  gct_i32 x, y;
+
+  for (y = 0; y < height; ++y) {
+    srcOffset = ((gct_iptr)StoredRow(src, sy + y)*src->tilesX + sx)*32;
+    destOffset = ((gct_iptr)StoredRow(dest, dy + y)*dest->tilesX + dx)*32;
+
+    if (!flip) {
+      memcpy(dest->color + destOffset, src->color + srcOffset,
+             (gct_uptr)width*32);
+      memcpy(dest->alpha + destOffset, src->alpha + srcOffset,
+             (gct_uptr)width*32);
+      continue;
+    }
+
+    // Rows are flipped by going through them in reverse,
+    // so only the supertiles themselves are flipped here
+    for (x = 0; x < width; ++x) {
+      FlipTile(dest->color + destOffset + x*32, src->color + srcOffset + x*32);
+      FlipTile(dest->alpha + destOffset + x*32, src->alpha + srcOffset + x*32);
+    }
+  }
+}
+
+gct_error_t gct_CropImage(const void *file, int x, int y,
+                          int width, int height,
+                          gct_header_t *hdr, void *output)
+{
+  const gct_header_t * const srcHdr = (const gct_header_t*)file;
+  tiles_t src, dest;
+  gct_i32 srcWidth, srcHeight;
+  gct_error_t err;
+
+  if (!file || !hdr || !output) return gct_ERR_NULL_POINTER;
+
+  err = ReadImageHeader(srcHdr, &srcWidth, &srcHeight);
+  if (err) return err;
+
+  if (!ValidImageSize(width, height) || (x & 7) || (y & 7) ||
+      x < 0 || y < 0 || x > srcWidth - width || y > srcHeight - height)
+    return gct_ERR_INVALID_SIZE;
+
+  // Everything but the size is kept, so a bottom-up image
+  // stays bottom-up and its rows are copied in order
+  *hdr = *srcHdr;
+  gct_STORE_BIG32(hdr->width, width);
+  gct_STORE_BIG32(hdr->height, height);
+  gct_STORE_BIG32(hdr->width2, width);
+  gct_STORE_BIG32(hdr->height2, height);
+
+  InitTiles(&src, srcHdr, srcWidth, srcHeight, srcHdr+1);
+  InitTiles(&dest, hdr, width, height, output);
+  CopyTiles(&dest, 0, 0, &src, x >> 3, y >> 3, width >> 3, height >> 3);
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_ComposeAtlas(const gct_header_t *hdr,
+                             const gct_atlas_part_t *parts,
+                             gct_uptr numParts, void *output)
+{
+  const gct_header_t *partHdr;
+  gct_u8 fillColor[32], fillAlpha[32];
+  tiles_t atlas, part;
+  gct_i32 width, height, partWidth, partHeight;
+  gct_iptr i;
+  gct_uptr n;
+  gct_error_t err;
+
+  if (!hdr || !output || (numParts && !parts))
+    return gct_ERR_NULL_POINTER;
+
+  width = gct_SIGNED_BIG32(hdr->width);
+  height = gct_SIGNED_BIG32(hdr->height);
+
+  if ((width != gct_SIGNED_BIG32(hdr->width2)) ||
+      (height != gct_SIGNED_BIG32(hdr->height2)) ||
+      !ValidImageSize(width, height))
+    return gct_ERR_INVALID_SIZE;
+  else if (!SupportedImageFlags(gct_BIG32(hdr->flags)))
+    return gct_ERR_UNSUPPORTED_FLAGS;
+
+  // Check every part before anything is written
+  for (n = 0; n < numParts; ++n) {
+    partHdr = (const gct_header_t*)parts[n].file;
+    if (!partHdr) return gct_ERR_NULL_POINTER;
+
+    err = ReadImageHeader(partHdr, &partWidth, &partHeight);
+    if (err) return err;
+
+    if ((parts[n].x & 7) || (parts[n].y & 7) ||
+        parts[n].x < 0 || parts[n].y < 0 ||
+        parts[n].x > width - partWidth || parts[n].y > height - partHeight)
+      return gct_ERR_INVALID_SIZE;
+  }
+
+  InitTiles(&atlas, hdr, width, height, output);
+
+  // Space no part covers is transparent black
+  for (i = 0; i < 4; ++i) {
+    CompressConstantColor(fillColor + i*8, 0, 0, 0);
+    CompressConstantAlpha(fillAlpha + i*8, 0);
+  }
+  for (i = 0; i < (gct_iptr)atlas.tilesX*atlas.tilesY; ++i) {
+    memcpy(atlas.color + i*32, fillColor, 32);
+    memcpy(atlas.alpha + i*32, fillAlpha, 32);
+  }
+
+  // Later parts are drawn over earlier ones
+  for (n = 0; n < numParts; ++n) {
+    partHdr = (const gct_header_t*)parts[n].file;
+    ReadImageHeader(partHdr, &partWidth, &partHeight);
+
+    InitTiles(&part, partHdr, partWidth, partHeight, partHdr+1);
+    CopyTiles(&atlas, parts[n].x >> 3, parts[n].y >> 3, &part, 0, 0,
+              part.tilesX, part.tilesY);
+  }
+
+  return gct_SUCCESS;
+}
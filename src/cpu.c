@@ -0,0 +1,57 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Runtime CPU feature detection
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "cpu.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+
+gct_u32 GetCPUFeatures(void) {
+  int info[4];
+  gct_u32 ret = 0;
+
+  __cpuid(info, 0);
+  if (info[0] < 1) return 0;
+
+  __cpuid(info, 1);
+  if (info[3] & (1<<26)) ret |= CPU_SSE2;
+
+  // AVX2 also needs the OS to save the upper halves of the YMM registers
+  if ((info[2] & (1<<27)) && ((_xgetbv(0) & 6) == 6)) {
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+      __cpuidex(info, 7, 0);
+      if (info[1] & (1<<5)) ret |= CPU_AVX2;
+    }
+  }
+
+  return ret;
+}
+#elif (defined(__GNUC__) || defined(__clang__)) &&   \
+  (defined(__x86_64__) || defined(__i386__))
+
+gct_u32 GetCPUFeatures(void) {
+  gct_u32 ret = 0;
+
+  // __builtin_cpu_supports already checks for OS support of AVX
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) ret |= CPU_SSE2;
+  if (__builtin_cpu_supports("avx2")) ret |= CPU_AVX2;
+
+  return ret;
+}
+#else
+
+gct_u32 GetCPUFeatures(void) {
+  return 0;
+}
+#endif
@@ -0,0 +1,23 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Runtime CPU feature detection
+ *
+ ******************************************************************************/
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#include "gct/gctlib.h"
+
+// CPU feature flags
+#define CPU_SSE2 0x00000001
+#define CPU_AVX2 0x00000002
+
+// Get features supported by the CPU (and OS) we're running on
+gct_u32 GetCPUFeatures(void);
+
+#endif //_CPU_H
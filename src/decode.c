@@ -13,27 +13,10 @@
 
 #include "gct/gctlib.h"
 #include "common.h"
+#include "thread.h"
+#include "cmpr.h"
 
-// 16-bit color type
-typedef union color16_s {
-  struct {
-    gct_u16 b : 5;
-    gct_u16 g : 6;
-    gct_u16 r : 5;
-  } c;
-
-  gct_u16 p;
-} color16_t;
-typedef gct_be16_t color16_be_t;
-
-// DXT1 block to decode
-typedef struct block_s {
-  color16_be_t col0, col1;
-  gct_be32_t pixelTable;
-} block_t;
-
-// Alpha component
-typedef gct_u8 gct_alpha_t;
+#include <string.h>
 
 gct_iptr gct_DecodedSize(const void *file) {
   gct_i32 width, height;
@@ -55,117 +38,548 @@ gct_iptr gct_DecodedSize(const void *file) {
   return width*height * sizeof(gct_color_t);
 }
 
-// Convert color16_t into gct_color_t
-static void Color16To32(color16_t c16, gct_color_t *c32) {
-  // Round colors
-  c32->r = (c16.c.r << 3) | (c16.c.r >> 2);
-  c32->g = (c16.c.g << 2) | (c16.c.g >> 4);
-  c32->b = (c16.c.b << 3) | (c16.c.b >> 2);
+// Decoder state shared by every strip of the image
+typedef struct decoder_s {
+  const gct_u8 *color, *alpha;
+  gct_i32 width, height;
+
+  // Rows of the image are stored bottom-up
+  gct_b32 flipped;
+
+  // Region being decoded, always inside the image
+  gct_i32 x, y, regionWidth, regionHeight;
+
+  // First pixel of the region in the output, bytes between rows,
+  // and size and format of output pixels
+  gct_u8 *output;
+  gct_iptr stride;
+  int pixelSize;
+  gct_pixel_format_t format;
+
+  // Column of the image at the top bit of each output row,
+  // and alpha threshold of gct_FORMAT_MASK1 output
+  gct_i32 maskX;
+  int maskThreshold;
+
+  // Block decoding kernels for this CPU
+  const cmpr_kernels_t *kernels;
+
+  // Number of strips the region is split into
+  int numStrips;
+} decoder_t;
+
+int DecodedPixelSize(gct_pixel_format_t format) {
+  switch (format) {
+  case gct_FORMAT_RGBA8:
+  case gct_FORMAT_BGRA8:
+  case gct_FORMAT_RGBA8_PREMUL:
+    return 4;
+  case gct_FORMAT_RGB8:
+    return 3;
+  case gct_FORMAT_RGB565:
+    return 2;
+  case gct_FORMAT_A8:
+    return 1;
+  default:
+    return 0;
+  }
 }
 
-// Convert alpha color16_t into gct_color_t
-static void Alpha16To32(color16_t a16, gct_alpha_t *out) {
-  // Round alpha
-  *out = (a16.c.g << 2) | (a16.c.g >> 4);
+void ConvertRow(const gct_color_t *src, gct_u8 *dest,
+                gct_i32 count, gct_pixel_format_t format)
+{
+  gct_u16 c;
+  int t;
+
+  switch (format) {
+  case gct_FORMAT_RGBA8:
+    memcpy(dest, src, count * sizeof(gct_color_t));
+    break;
+
+  case gct_FORMAT_BGRA8:
+    for (; count > 0; --count, ++src, dest += 4) {
+      dest[0] = src->b;
+      dest[1] = src->g;
+      dest[2] = src->r;
+      dest[3] = src->a;
+    }
+    break;
+
+  case gct_FORMAT_RGB8:
+    for (; count > 0; --count, ++src, dest += 3) {
+      dest[0] = src->r;
+      dest[1] = src->g;
+      dest[2] = src->b;
+    }
+    break;
+
+  case gct_FORMAT_RGBA8_PREMUL:
+    // Color * alpha / 255, rounded to the nearest value
+#define PREMUL(_c) (t = (_c)*src->a + 128, (gct_u8)((t + (t >> 8)) >> 8))
+    for (; count > 0; --count, ++src, dest += 4) {
+      dest[0] = PREMUL(src->r);
+      dest[1] = PREMUL(src->g);
+      dest[2] = PREMUL(src->b);
+      dest[3] = src->a;
+    }
+#undef PREMUL
+    break;
+
+  case gct_FORMAT_RGB565:
+    // Decoded colors came from 565, so the top bits are exact
+    for (; count > 0; --count, ++src, dest += 2) {
+      c = (gct_u16)(((src->r >> 3) << 11) | ((src->g >> 2) << 5) |
+                    (src->b >> 3));
+      memcpy(dest, &c, 2);
+    }
+    break;
+
+  case gct_FORMAT_A8:
+    for (; count > 0; --count, ++src, ++dest)
+      *dest = src->a;
+    break;
+  }
 }
 
-// Lerp 1 third of color a, and 2 thirds of color b
-static void Lerp13(const gct_color_t *a, const gct_color_t *b, gct_color_t *out) {
-  out->r = ((gct_u32)a->r + (gct_u32)b->r*2) / 3;
-  out->g = ((gct_u32)a->g + (gct_u32)b->g*2) / 3;
-  out->b = ((gct_u32)a->b + (gct_u32)b->b*2) / 3;
+// Write a run of count bits, starting at bit pos of a mask row.
+// bits has the first bit of the run in its top bit
+static void WriteMaskBits(gct_u8 *row, gct_i32 pos, unsigned bits, int count) {
+  const unsigned mask = (0xff00u >> count) & 0xff;
+  const int shift = pos & 7;
+  gct_u8 * const out = row + (pos >> 3);
+  unsigned b = ((bits & mask) << 8) >> shift;
+  unsigned m = (mask << 8) >> shift;
+
+  out[0] = (gct_u8)((out[0] & ~(m >> 8)) | (b >> 8));
+  if (m & 0xff)
+    out[1] = (gct_u8)((out[1] & ~m) | (b & 0xff));
 }
 
-// Extract info from file block
-static void ExtractBlock(const block_t *blk, const block_t *ablk,
-                         gct_u32 *pixelTable, gct_u32 *aPixelTable,
-                         gct_color_t *pal, gct_alpha_t *apal)
+// Decode only the alpha plane of a supertile, for
+// gct_FORMAT_A8 and gct_FORMAT_MASK1 output
+static void DecodeAlphaSupertile(const decoder_t *dec, gct_iptr offset,
+                                 gct_i32 x, gct_i32 y, gct_i32 x0, gct_i32 y0,
+                                 gct_i32 x1, gct_i32 y1, gct_u8 *out)
 {
-  color16_t col0, col1, acol0, acol1;
+  gct_u8 tile[64];
+  gct_i32 row;
+
+  if (dec->format == gct_FORMAT_MASK1) {
+    // Alpha values are never decoded for masks
+    DecodeMaskTile(dec->alpha + offset, dec->maskThreshold, tile);
+
+    // Whole supertiles on a byte are one byte per row
+    if (x0 == x && y0 == y && x1 == x+8 && y1 == y+8 &&
+        !((x - dec->maskX) & 7)) {
+      out += (x - dec->maskX) >> 3;
+      for (row = 0; row < 8; ++row, out += dec->stride)
+        *out = tile[row];
+      return;
+    }
 
-  col0.p = gct_BIG16(blk->col0);
-  col1.p = gct_BIG16(blk->col1);
-  acol0.p = gct_BIG16(ablk->col0);
-  acol1.p = gct_BIG16(ablk->col1);
+    for (row = y0; row < y1; ++row, out += dec->stride)
+      WriteMaskBits(out, x0 - dec->maskX,
+                    (unsigned)(tile[row-y] << (x0-x)), x1-x0);
+    return;
+  }
 
-  Color16To32(col0, pal);
-  Color16To32(col1, pal+1);
-  Lerp13(pal+1, pal, pal+2);
-  Lerp13(pal, pal+1, pal+3);
+  // Whole supertiles go straight to the output
+  if (x0 == x && y0 == y && x1 == x+8 && y1 == y+8) {
+    dec->kernels->decodeAlphaTile(dec->alpha + offset, dec->stride, out);
+    return;
+  }
 
-  Alpha16To32(acol0, apal);
-  Alpha16To32(acol1, apal+1);
+  dec->kernels->decodeAlphaTile(dec->alpha + offset, 8, tile);
+  for (row = y0; row < y1; ++row, out += dec->stride)
+    memcpy(out, tile + (row-y)*8 + (x0-x), x1-x0);
+}
 
-  // Lerp alpha values
-  apal[2] = (apal[0]*2 + apal[1]) / 3;
-  apal[3] = (apal[0] + apal[1]*2) / 3;
+// Decode supertile at (x, y) in the image, only the part of it
+// inside the region is written
+static void DecodeSupertile(const decoder_t *dec, gct_i32 x, gct_i32 y) {
+  // Every 8x8 supertile is 32 bytes long in each plane
+  const gct_iptr offset = ((gct_iptr)y*dec->width + x*8) >> 1;
+  const gct_i32 x0 = x > dec->x ? x : dec->x;
+  const gct_i32 y0 = y > dec->y ? y : dec->y;
+  const gct_i32 x1 = x+8 < dec->x + dec->regionWidth ?
+    x+8 : dec->x + dec->regionWidth;
+  const gct_i32 y1 = y+8 < dec->y + dec->regionHeight ?
+    y+8 : dec->y + dec->regionHeight;
+  gct_u8 *out = dec->output + (y0 - dec->y)*dec->stride +
+    (x0 - dec->x)*(gct_iptr)dec->pixelSize;
+  gct_color_t tile[64];
+  gct_i32 row;
+
+  // Color plane isn't needed for alpha
+  if (dec->format == gct_FORMAT_A8 || dec->format == gct_FORMAT_MASK1) {
+    DecodeAlphaSupertile(dec, offset, x, y, x0, y0, x1, y1, out);
+    return;
+  }
 
-  *pixelTable = gct_BIG32(blk->pixelTable);
-  *aPixelTable = gct_BIG32(ablk->pixelTable);
+  // Whole RGBA supertiles go straight to the output
+  // when rows are whole pixels
+  if (dec->format == gct_FORMAT_RGBA8 &&
+      x0 == x && y0 == y && x1 == x+8 && y1 == y+8 &&
+      !(dec->stride % (gct_iptr)sizeof(gct_color_t))) {
+    dec->kernels->decodeTile(dec->color + offset, dec->alpha + offset,
+                             dec->stride / (gct_iptr)sizeof(gct_color_t),
+                             (gct_color_t*)out);
+    return;
+  }
+
+  // Anything else is converted from a supertile on the stack
+  dec->kernels->decodeTile(dec->color + offset, dec->alpha + offset, 8, tile);
+  for (row = y0; row < y1; ++row, out += dec->stride)
+    ConvertRow(tile + (row-y)*8 + (x0-x), out, x1-x0, dec->format);
 }
 
-// Decode DXT1 block into image data
-static void DecodeDXT1(const block_t *blk, const block_t *ablk,
-                       gct_iptr stride, gct_color_t *out)
-{
-  gct_color_t pal[4];
-  gct_alpha_t apal[4];
-  gct_u32 pixelTable, aPixelTable;
-  gct_u32 i;
+// Decode strip of supertile rows of the region
+static void DecodeStrip(void *arg, int index) {
+  const decoder_t * const dec = (decoder_t*)arg;
+  const gct_i32 xStart = dec->x & ~7;
+  const gct_i32 yStart = dec->y & ~7;
+  const gct_i32 xEnd = dec->x + dec->regionWidth;
+  const gct_iptr rows = (dec->y + dec->regionHeight - yStart + 7) >> 3;
+  gct_i32 x, y, yEnd;
+
+  y = yStart + (gct_i32)((rows*index / dec->numStrips) << 3);
+  yEnd = yStart + (gct_i32)((rows*(index+1) / dec->numStrips) << 3);
+  for (; y < yEnd; y += 8) {
+    for (x = xStart; x < xEnd; x += 8)
+      DecodeSupertile(dec, x, y);
+  }
+}
+
+// Decode region of the image that's already been clipped
+static void DecodeRegion(decoder_t *dec, const gct_decode_options_t *opts) {
+  int numThreads;
 
-  stride -= 4;
+  // Never use more threads than there are supertile rows
+  numThreads = opts->pool ? GetPoolSize(opts->pool) : opts->numThreads;
+  if (numThreads <= 0) numThreads = GetCPUCount();
+  if (numThreads > ((dec->y + dec->regionHeight - (dec->y & ~7) + 7) >> 3))
+    numThreads = (dec->y + dec->regionHeight - (dec->y & ~7) + 7) >> 3;
 
-  ExtractBlock(blk, ablk, &pixelTable, &aPixelTable, pal, apal);
+  dec->kernels = GetCMPRKernels();
+  dec->numStrips = numThreads;
+  if (opts->pool) RunPool(opts->pool, numThreads, DecodeStrip, dec);
+  else RunThreads(numThreads, DecodeStrip, dec);
+}
 
-  // Write colors into image based on pixel table
-  for (i = 0; i < 16; ++i, ++out, pixelTable <<= 2, aPixelTable <<= 2) {
-    *out = pal[pixelTable >> 30];
-    out->a = apal[aPixelTable >> 30];
+void gct_InitDecodeOptions(gct_decode_options_t *opts) {
+  if (!opts) return;
 
-    if ((i&3) == 3) out += stride;
-  }
+  opts->numThreads = 1;
+  opts->pool = NULL;
+  opts->maskThreshold = 128;
 }
 
 gct_error_t gct_Decode(const void *file, int *width,
                        int *height, gct_color_t *output)
 {
-  gct_i32 w, h;
+  return gct_DecodeEx(file, width, height, output, NULL);
+}
+
+gct_error_t gct_DecodeEx(const void *file, int *width, int *height,
+                         gct_color_t *output, const gct_decode_options_t *opts)
+{
   const gct_header_t * const hdr = (gct_header_t*)file;
-  gct_iptr x;
-  gct_iptr y;
-  const block_t *blk, *ablk;
+  gct_decode_options_t defaultOpts;
+  decoder_t dec;
+  gct_error_t err;
 
   if (!file || !width || !height || !output)
     return gct_ERR_NULL_POINTER;
 
-  w = gct_SIGNED_BIG32(hdr->width);
-  h = gct_SIGNED_BIG32(hdr->height);
+  if (!opts) {
+    gct_InitDecodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
 
-  if ((w != gct_SIGNED_BIG32(hdr->width2)) ||
-      (h != gct_SIGNED_BIG32(hdr->height2)) ||
-      !ValidImageSize(w, h))
-    return gct_ERR_INVALID_IMAGE;
-  else if (!SupportedImageFlags(gct_BIG32(hdr->flags)))
-    return gct_ERR_UNSUPPORTED_IMAGE;
-
-  *width = w;
-  *height = h;
-
-  blk = (block_t*)(hdr+1);
-  ablk = blk + w*h/16;
-  for (y = 0; y < h; y += 8) {
-    for (x = 0; x < w; x += 8) {
-      // Decode in CMPR subtile arrangement
-      DecodeDXT1(blk++, ablk++, w, output);
-      DecodeDXT1(blk++, ablk++, w, output+4);
-      DecodeDXT1(blk++, ablk++, w, output + w*4);
-      DecodeDXT1(blk++, ablk++, w, output+4 + w*4);
-
-      output += 8;
+  err = ReadImageHeader(hdr, &dec.width, &dec.height);
+  if (err) return err;
+
+  *width = dec.width;
+  *height = dec.height;
+
+  dec.color = (const gct_u8*)(hdr+1);
+  dec.alpha = dec.color + ((dec.width*dec.height) >> 1);
+  dec.x = dec.y = 0;
+  dec.regionWidth = dec.width;
+  dec.regionHeight = dec.height;
+  dec.output = (gct_u8*)output;
+  dec.stride = (gct_iptr)dec.width * sizeof(gct_color_t);
+
+  // Stored rows go to the output bottom-up, so it's upright
+  if (ImageFlipped(hdr)) {
+    dec.output += (dec.height-1) * dec.stride;
+    dec.stride = -dec.stride;
+  }
+  dec.pixelSize = sizeof(gct_color_t);
+  dec.format = gct_FORMAT_RGBA8;
+
+  DecodeRegion(&dec, opts);
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_DecodeRect(const void *file, int x, int y,
+                           int width, int height, gct_color_t *output,
+                           gct_iptr stride, const gct_decode_options_t *opts)
+{
+  gct_output_desc_t desc;
+
+  desc.pixels = output;
+  desc.stride = stride;
+  desc.format = gct_FORMAT_RGBA8;
+  desc.flip = gct_false;
+
+  return gct_DecodeImage(file, x, y, width, height, &desc, opts);
+}
+
+// Decode region of an image in any pixel format, dec only has the
+// planes and size of the image set
+static gct_error_t DecodeImage(decoder_t *dec, int x, int y,
+                               int width, int height,
+                               const gct_output_desc_t *output,
+                               const gct_decode_options_t *opts)
+{
+  gct_decode_options_t defaultOpts;
+  gct_u8 *pixels;
+  gct_i32 x1, y1;
+  gct_b32 flip;
+
+  if (!output || !output->pixels)
+    return gct_ERR_NULL_POINTER;
+  else if (width <= 0 || height <= 0)
+    return gct_ERR_INVALID_SIZE;
+
+  // Mask pixels don't take up whole bytes, so the output
+  // only moves between rows and every bit is placed from maskX
+  dec->pixelSize = DecodedPixelSize(output->format);
+  if (!dec->pixelSize && output->format != gct_FORMAT_MASK1)
+    return gct_ERR_UNSUPPORTED_FORMAT;
+
+  if (!opts) {
+    gct_InitDecodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  // Region of a bottom-up image is found upside down in the stored rows,
+  // then flipped back on its way to the output
+  flip = output->flip;
+  if (dec->flipped) {
+    y = dec->height - y - height;
+    flip = !flip;
+  }
+
+  // Flipped output is the same as starting from
+  // the bottom row and going upwards
+  pixels = (gct_u8*)output->pixels;
+  dec->stride = output->stride;
+  if (flip) {
+    pixels += (height-1) * dec->stride;
+    dec->stride = -dec->stride;
+  }
+
+  // Clip region to the image, parts outside it aren't written
+  x1 = x > dec->width - width ? dec->width : x + width;
+  y1 = y > dec->height - height ? dec->height : y + height;
+  dec->x = x < 0 ? 0 : x;
+  dec->y = y < 0 ? 0 : y;
+  if (dec->x >= x1 || dec->y >= y1) return gct_SUCCESS;
+
+  dec->maskX = x;
+  dec->maskThreshold = opts->maskThreshold;
+  dec->regionWidth = x1 - dec->x;
+  dec->regionHeight = y1 - dec->y;
+  dec->format = output->format;
+  dec->output = pixels + (dec->y - y)*dec->stride +
+    (dec->x - x)*(gct_iptr)dec->pixelSize;
+
+  DecodeRegion(dec, opts);
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_DecodeImage(const void *file, int x, int y,
+                            int width, int height,
+                            const gct_output_desc_t *output,
+                            const gct_decode_options_t *opts)
+{
+  const gct_header_t * const hdr = (gct_header_t*)file;
+  decoder_t dec;
+  gct_error_t err;
+
+  if (!file) return gct_ERR_NULL_POINTER;
+
+  err = ReadImageHeader(hdr, &dec.width, &dec.height);
+  if (err) return err;
+
+  dec.color = (const gct_u8*)(hdr+1);
+  dec.alpha = dec.color + ((dec.width*dec.height) >> 1);
+  dec.flipped = ImageFlipped(hdr);
+  return DecodeImage(&dec, x, y, width, height, output, opts);
+}
+
+gct_error_t gct_DecodeFile(const gct_file_t *file, int x, int y,
+                           int width, int height,
+                           const gct_output_desc_t *output,
+                           const gct_decode_options_t *opts)
+{
+  const gct_file_info_t *info;
+  decoder_t dec;
+
+  if (!file) return gct_ERR_NULL_POINTER;
+
+  // Header was checked when the file was opened
+  info = gct_GetFileInfo(file);
+  dec.width = info->width;
+  dec.height = info->height;
+  dec.color = (const gct_u8*)info->color;
+  dec.alpha = (const gct_u8*)info->alpha;
+  dec.flipped = info->flipped;
+  return DecodeImage(&dec, x, y, width, height, output, opts);
+}
+
+// Thumbnail decoder state shared by every strip
+typedef struct thumbnail_s {
+  const gct_u8 *color, *alpha;
+  gct_i32 width, height;
+
+  // Image pixels per thumbnail pixel in each direction, 4 or 8
+  int scale;
+
+  gct_u8 *output;
+  gct_iptr stride;
+  int pixelSize;
+  gct_pixel_format_t format;
+
+  int numStrips;
+} thumbnail_t;
+
+// Supertiles averaged before writing them to the output
+#define THUMBNAIL_CHUNK 64
+
+// Get average of a group of pixels from their sums,
+// shift is log2 of the number of pixels
+static void AveragePixel(const int *sums, int shift, gct_color_t *out) {
+  const int round = 1 << (shift-1);
+
+  out->r = (gct_u8)((sums[0] + round) >> shift);
+  out->g = (gct_u8)((sums[1] + round) >> shift);
+  out->b = (gct_u8)((sums[2] + round) >> shift);
+  out->a = (gct_u8)((sums[3] + round) >> shift);
+}
+
+// Make thumbnail of a strip of supertile rows
+static void ThumbnailStrip(void *arg, int index) {
+  const thumbnail_t * const thumb = (thumbnail_t*)arg;
+  const gct_i32 rows = thumb->height >> 3;
+  const gct_i32 yStart = (gct_i32)((gct_iptr)rows*index / thumb->numStrips);
+  const gct_i32 yEnd = (gct_i32)((gct_iptr)rows*(index+1) / thumb->numStrips);
+  const gct_i32 tilesX = thumb->width >> 3;
+  const int perTile = 8 / thumb->scale;
+  gct_color_t row[2][THUMBNAIL_CHUNK*2];
+  const gct_u8 *color, *alpha;
+  gct_i32 x, y, count;
+  gct_u8 *out;
+  int sums[4], i;
+
+  for (y = yStart; y < yEnd; ++y) {
+    out = thumb->output + y*perTile*thumb->stride;
+
+    for (x = 0; x < tilesX; x += count) {
+      count = tilesX - x;
+      if (count > THUMBNAIL_CHUNK) count = THUMBNAIL_CHUNK;
+
+      for (i = 0; i < count; ++i) {
+        color = thumb->color + ((gct_iptr)y*tilesX + x + i)*32;
+        alpha = thumb->alpha + ((gct_iptr)y*tilesX + x + i)*32;
+
+        if (perTile == 1) {
+          // Whole supertile is one pixel
+          sums[0] = sums[1] = sums[2] = sums[3] = 0;
+          SumBlockPixels(color, alpha, sums);
+          SumBlockPixels(color+8, alpha+8, sums);
+          SumBlockPixels(color+16, alpha+16, sums);
+          SumBlockPixels(color+24, alpha+24, sums);
+          AveragePixel(sums, 6, &row[0][i]);
+          continue;
+        }
+
+        // Each block is one pixel, blocks are top left,
+        // top right, bottom left, then bottom right
+        sums[0] = sums[1] = sums[2] = sums[3] = 0;
+        SumBlockPixels(color, alpha, sums);
+        AveragePixel(sums, 4, &row[0][i*2]);
+
+        sums[0] = sums[1] = sums[2] = sums[3] = 0;
+        SumBlockPixels(color+8, alpha+8, sums);
+        AveragePixel(sums, 4, &row[0][i*2+1]);
+
+        sums[0] = sums[1] = sums[2] = sums[3] = 0;
+        SumBlockPixels(color+16, alpha+16, sums);
+        AveragePixel(sums, 4, &row[1][i*2]);
+
+        sums[0] = sums[1] = sums[2] = sums[3] = 0;
+        SumBlockPixels(color+24, alpha+24, sums);
+        AveragePixel(sums, 4, &row[1][i*2+1]);
+      }
+
+      for (i = 0; i < perTile; ++i)
+        ConvertRow(row[i], out + i*thumb->stride + x*perTile*thumb->pixelSize,
+                   count*perTile, thumb->format);
     }
+  }
+}
+
+gct_error_t gct_DecodeThumbnail(const void *file, int scale,
+                                const gct_output_desc_t *output,
+                                const gct_decode_options_t *opts)
+{
+  const gct_header_t * const hdr = (gct_header_t*)file;
+  gct_decode_options_t defaultOpts;
+  thumbnail_t thumb;
+  gct_error_t err;
+  int numThreads;
+
+  if (!file || !output || !output->pixels)
+    return gct_ERR_NULL_POINTER;
+  else if (scale != 4 && scale != 8)
+    return gct_ERR_INVALID_SIZE;
 
-    output += w*7;
+  thumb.pixelSize = DecodedPixelSize(output->format);
+  if (!thumb.pixelSize) return gct_ERR_UNSUPPORTED_FORMAT;
+
+  if (!opts) {
+    gct_InitDecodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  err = ReadImageHeader(hdr, &thumb.width, &thumb.height);
+  if (err) return err;
+
+  thumb.color = (const gct_u8*)(hdr+1);
+  thumb.alpha = thumb.color + ((thumb.width*thumb.height) >> 1);
+  thumb.scale = scale;
+  thumb.format = output->format;
+
+  // Flipped output is the same as starting from the bottom row and
+  // going upwards, stored rows of bottom-up images are flipped back
+  thumb.output = (gct_u8*)output->pixels;
+  thumb.stride = output->stride;
+  if (!output->flip != !ImageFlipped(hdr)) {
+    thumb.output += (thumb.height/scale - 1) * thumb.stride;
+    thumb.stride = -thumb.stride;
   }
 
+  // Never use more threads than there are supertile rows
+  numThreads = opts->pool ? GetPoolSize(opts->pool) : opts->numThreads;
+  if (numThreads <= 0) numThreads = GetCPUCount();
+  if (numThreads > (thumb.height >> 3)) numThreads = thumb.height >> 3;
+
+  thumb.numStrips = numThreads;
+  if (opts->pool) RunPool(opts->pool, numThreads, ThumbnailStrip, &thumb);
+  else RunThreads(numThreads, ThumbnailStrip, &thumb);
+
   return gct_SUCCESS;
 }
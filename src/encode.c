@@ -13,15 +13,12 @@
 
 #include "gct/gctlib.h"
 #include "common.h"
+#include "thread.h"
+#include "cmpr.h"
 
+#include <stdlib.h>
 #include <string.h>
-
-// Header-only DXT1 encoder by fabian "ryg" giesen and stb
-// Copyright(c) 2017 Sean Barrett
-// Look in stb_dxt.h for license information
-#define STB_DXT_IMPLEMENTATION
-#define STB_DXT_STATIC
-#include "thirdParty/stb_dxt.h"
+#include <limits.h>
 
 gct_error_t gct_InitHeader(gct_header_t *hdr, int width,
                            int height, gct_u32 flags)
@@ -70,122 +67,1131 @@ gct_iptr gct_EncodedSize(const gct_header_t *hdr) {
   return width*height;
 }
 
-// Get 4x4 group of RGBA pixels from image
-static void GetImageRect(const gct_color_t *src, gct_uptr stride,
-                         gct_iptr x, gct_iptr y, gct_color_t *output)
+// Encoder state shared by every strip of the image
+typedef struct encoder_s {
+  // Rows being encoded, and where their blocks go in each plane.
+  // Input starts at the bottom row going upwards when flipped
+  gct_image_desc_t input;
+  unsigned char *color, *alpha;
+  gct_i32 numRows;
+
+  gct_i32 width, height;
+
+  // Block compression kernels for this CPU
+  const cmpr_kernels_t *kernels;
+
+  // Quality presets of each plane
+  gct_quality_t colorQuality, alphaQuality;
+
+  // Squared error of a block above which gct_QUALITY_ADAPTIVE
+  // compresses it again, for each plane
+  int colorThreshold, alphaThreshold;
+
+  // Whether block errors are added to the block counters
+  gct_b32 measureError;
+
+  // Rows are stored bottom-up
+  gct_b32 flip;
+
+  // Planes of an earlier version of the image, with blocks at the same
+  // offsets as the blocks being written, NULL to encode from scratch
+  const unsigned char *priorColor, *priorAlpha;
+
+  // Hash of the pixels of every 4x4 block, NULL to not hash blocks
+  gct_u32 *blockHashes;
+
+  // Thread pool to run strips on, NULL to start threads for every band
+  gct_thread_pool_t *pool;
+
+  // Most threads used at once, and number of strips
+  // the rows being encoded are split into
+  int numThreads, numStrips;
+
+  // Block counters of each strip, NULL if they aren't needed
+  gct_encode_stats_t *stripStats;
+} encoder_t;
+
+// Get 4x4 group of pixels from the rows being encoded, as RGBA
+static void GetImageRect(const encoder_t *enc, gct_iptr x, gct_iptr y,
+                         gct_color_t *output)
+{
+  const gct_u8 *row = (const gct_u8*)enc->input.pixels + y*enc->input.stride;
+  const gct_u8 *p;
+  int i, j, a;
+
+  for (i = 0; i < 4; ++i, row += enc->input.stride) {
+    switch (enc->input.format) {
+    case gct_FORMAT_RGBA8:
+      memcpy(output, row + x*4, sizeof(gct_color_t)*4);
+      output += 4;
+      break;
+
+    case gct_FORMAT_BGRA8:
+      for (j = 0, p = row + x*4; j < 4; ++j, p += 4, ++output) {
+        output->r = p[2];
+        output->g = p[1];
+        output->b = p[0];
+        output->a = p[3];
+      }
+      break;
+
+    case gct_FORMAT_RGB8:
+      for (j = 0, p = row + x*3; j < 4; ++j, p += 3, ++output) {
+        output->r = p[0];
+        output->g = p[1];
+        output->b = p[2];
+        output->a = 255;
+      }
+      break;
+
+    case gct_FORMAT_RGBA8_PREMUL:
+      // Undo premultiplication, rounded to the nearest value.
+      // Color of fully transparent pixels is lost, so it's black
+      for (j = 0, p = row + x*4; j < 4; ++j, p += 4, ++output) {
+        a = p[3];
+        if (a == 255) {
+          output->r = p[0];
+          output->g = p[1];
+          output->b = p[2];
+        } else if (a) {
+          output->r = (gct_u8)(p[0] >= a ? 255 : (p[0]*255 + (a >> 1)) / a);
+          output->g = (gct_u8)(p[1] >= a ? 255 : (p[1]*255 + (a >> 1)) / a);
+          output->b = (gct_u8)(p[2] >= a ? 255 : (p[2]*255 + (a >> 1)) / a);
+        } else {
+          output->r = output->g = output->b = 0;
+        }
+        output->a = (gct_u8)a;
+      }
+      break;
+    }
+  }
+}
+
+// Compress color block, escalating through the quality presets
+// when using gct_QUALITY_ADAPTIVE. Blocks start from the endpoints
+// of prior if it isn't NULL. Returns squared error of the block,
+// or -1 if it wasn't measured
+static int EncodeColor(const encoder_t *enc, gct_encode_stats_t *stats,
+                       const gct_color_t *rect, unsigned char *block,
+                       const unsigned char *prior)
 {
-  const gct_iptr xEnd = x+4;
-  const gct_iptr yEnd = y+4;
-  const gct_iptr xOrig = x;
+  gct_u8 retry[8];
+  gct_quality_t q;
+  int err, retryErr;
+
+  if (enc->colorQuality != gct_QUALITY_ADAPTIVE && !prior) {
+    CompressColorBlock(enc->kernels, block, rect, enc->colorQuality);
+    return enc->measureError ? ColorBlockError(block, rect) : -1;
+  }
+
+  if (enc->colorQuality != gct_QUALITY_ADAPTIVE) {
+    // Blocks the old endpoints don't fit well
+    // are compressed from scratch too
+    WarmColorBlock(enc->kernels, block, rect, enc->colorQuality, prior);
+    err = ColorBlockError(block, rect);
+    if (err <= enc->colorThreshold) return err;
+
+    CompressColorBlock(enc->kernels, retry, rect, enc->colorQuality);
+    retryErr = ColorBlockError(retry, rect);
+    if (retryErr < err) {
+      memcpy(block, retry, sizeof(retry));
+      err = retryErr;
+    }
+
+    return err;
+  }
+
+  if (prior)
+    WarmColorBlock(enc->kernels, block, rect, gct_QUALITY_FAST, prior);
+  else
+    CompressColorBlock(enc->kernels, block, rect, gct_QUALITY_FAST);
+  err = ColorBlockError(block, rect);
+  if (err <= enc->colorThreshold) return err;
 
-  for (; y < yEnd; ++y) {
-    for (; x < xEnd; ++x, ++output) {
-      *output = src[y*stride + x];
+  ++stats->colorEscalated;
+  for (q = gct_QUALITY_HIGH; q <= gct_QUALITY_EXHAUSTIVE; ++q) {
+    CompressColorBlock(enc->kernels, retry, rect, q);
+    retryErr = ColorBlockError(retry, rect);
+
+    if (retryErr < err) {
+      memcpy(block, retry, sizeof(retry));
+      err = retryErr;
     }
 
-    x = xOrig;
+    if (err <= enc->colorThreshold) break;
   }
+
+  return err;
 }
 
-// Get 4x4 group of alpha pixels from image,
-// coded as green pixels
-static void GetAlphaRect(const gct_color_t *src, gct_uptr stride,
-                         gct_iptr x, gct_iptr y, gct_color_t *output)
+// Same as EncodeColor, for alpha blocks. Endpoints of prior are
+// only used when they fit better, so there's nothing to fall back on
+static int EncodeAlpha(const encoder_t *enc, gct_encode_stats_t *stats,
+                       const gct_u8 *arect, unsigned char *alpha,
+                       const unsigned char *prior)
 {
-  const gct_iptr xEnd = x+4;
-  const gct_iptr yEnd = y+4;
-  const gct_iptr xOrig = x;
+  gct_u8 retry[8];
+  gct_quality_t q;
+  int err, retryErr;
+
+  if (enc->alphaQuality != gct_QUALITY_ADAPTIVE) {
+    if (prior)
+      WarmAlphaBlock(enc->kernels, alpha, arect, enc->alphaQuality, prior);
+    else
+      CompressAlphaBlock(enc->kernels, alpha, arect, enc->alphaQuality);
+    return enc->measureError ? AlphaBlockError(alpha, arect) : -1;
+  }
+
+  if (prior)
+    WarmAlphaBlock(enc->kernels, alpha, arect, gct_QUALITY_FAST, prior);
+  else
+    CompressAlphaBlock(enc->kernels, alpha, arect, gct_QUALITY_FAST);
+  err = AlphaBlockError(alpha, arect);
+  if (err <= enc->alphaThreshold) return err;
 
-  for (; y < yEnd; ++y) {
-    for (; x < xEnd; ++x, ++output) {
-      output->r = output->b = output->a = 0;
-      output->g = src[y*stride + x].a;
+  ++stats->alphaEscalated;
+  for (q = gct_QUALITY_HIGH; q <= gct_QUALITY_EXHAUSTIVE; ++q) {
+    CompressAlphaBlock(enc->kernels, retry, arect, q);
+    retryErr = AlphaBlockError(retry, arect);
+
+    if (retryErr < err) {
+      memcpy(alpha, retry, sizeof(retry));
+      err = retryErr;
     }
 
-    x = xOrig;
+    if (err <= enc->alphaThreshold) break;
   }
+
+  return err;
 }
 
-// Flip 2-bit components in byte
-static unsigned char FlipByte(unsigned char c) {
-  return ((c<<6) |
-          ((c<<2)&0x30) |
-          ((c>>2)&0x0c) |
-          (c>>6));
+// Hash pixels of a 4x4 block with MurmurHash3, to tell if they changed
+static gct_u32 BlockHash(const gct_color_t *rect) {
+  gct_u32 h = 0, k;
+  int i;
+
+  for (i = 0; i < 16; ++i) {
+    k = rect[i].r | (rect[i].g << 8) | ((gct_u32)rect[i].b << 16) |
+      ((gct_u32)rect[i].a << 24);
+
+    k *= 0xcc9e2d51u;
+    k = (k << 15) | (k >> 17);
+    k *= 0x1b873593u;
+
+    h ^= k;
+    h = (h << 13) | (h >> 19);
+    h = h*5 + 0xe6546b64u;
+  }
+
+  // Mix in the length, then the final avalanche
+  h ^= 64;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  return h ^ (h >> 16);
 }
 
-// We need to write the DXT1 in big endian, stb_compress_dxt_block writes it
-// in little endian
-static void SwapDXT(unsigned char *block) {
-  unsigned char tmp;
+// Encode 4x4 block of the image into both planes, blocks that
+// are constant or fully transparent skip the block compressors
+static void EncodeBlock(const encoder_t *enc, gct_encode_stats_t *stats,
+                        const gct_color_t *rect, unsigned char *block,
+                        unsigned char *alpha)
+{
+  // Blocks of the prior planes are at the same offsets
+  const gct_iptr offset = block - enc->color;
+  const unsigned char *priorColor = NULL, *priorAlpha = NULL;
+  gct_u8 arect[16];
+  gct_b32 constColor = gct_true, constAlpha = gct_true;
+  int i, r, g, b, colorErr = -1, alphaErr = -1;
+  gct_u32 hash;
+
+  if (enc->blockHashes) {
+    hash = BlockHash(rect);
+
+    // Pixels didn't change, so the old blocks are kept as they are
+    if (enc->priorColor && enc->blockHashes[offset >> 3] == hash) {
+      memmove(block, enc->priorColor + offset, 8);
+      memmove(alpha, enc->priorAlpha + offset, 8);
+      ++stats->blocksKept;
+      return;
+    }
+
+    enc->blockHashes[offset >> 3] = hash;
+  }
+
+  if (enc->priorColor) {
+    priorColor = enc->priorColor + offset;
+    priorAlpha = enc->priorAlpha + offset;
+  }
+
+  for (i = 0; i < 16; ++i) {
+    arect[i] = rect[i].a;
+
+    if (rect[i].r != rect->r || rect[i].g != rect->g ||
+        rect[i].b != rect->b)
+      constColor = gct_false;
+    if (rect[i].a != rect->a)
+      constAlpha = gct_false;
+  }
+
+  if (constColor) {
+    CompressConstantColor(block, rect->r, rect->g, rect->b);
+    if (enc->measureError) colorErr = ColorBlockError(block, rect);
+    ++stats->colorConstant;
+  } else if (constAlpha && !rect->a) {
+    // Color of fully transparent blocks can't be seen,
+    // so use the average color
+    r = g = b = 8;
+    for (i = 0; i < 16; ++i) {
+      r += rect[i].r;
+      g += rect[i].g;
+      b += rect[i].b;
+    }
 
-  tmp = block[0];
-  block[0] = block[1];
-  block[1] = tmp;
+    CompressConstantColor(block, r >> 4, g >> 4, b >> 4);
+    ++stats->colorTransparent;
+  } else {
+    colorErr = EncodeColor(enc, stats, rect, block, priorColor);
+    ++stats->colorCompressed;
+  }
 
-  tmp = block[2];
-  block[2] = block[3];
-  block[3] = tmp;
+  if (constAlpha) {
+    CompressConstantAlpha(alpha, rect->a);
+    if (enc->measureError) alphaErr = AlphaBlockError(alpha, arect);
+    ++stats->alphaConstant;
+  } else {
+    alphaErr = EncodeAlpha(enc, stats, arect, alpha, priorAlpha);
+    ++stats->alphaCompressed;
+  }
 
-  // stb_compress_dxt_block writes table
-  // from lsb to msb, in CMPR it's from
-  // msb to lsb
-  block[4] = FlipByte(block[4]);
-  block[5] = FlipByte(block[5]);
-  block[6] = FlipByte(block[6]);
-  block[7] = FlipByte(block[7]);
+  // Errors are summed here, and averaged once every strip is done
+  if (colorErr > 0) stats->colorError += colorErr;
+  if (alphaErr > 0) stats->alphaError += alphaErr;
 }
 
 #define ENCODE_SUBTILE(_xOff, _yOff)                                    \
-  GetImageRect(input, width, x+(_xOff), y+(_yOff), rect);               \
-  stb_compress_dxt_block(block, (unsigned char*)rect,                   \
-                         0, STB_DXT_HIGHQUAL);                          \
-  SwapDXT(block);                                                       \
+  GetImageRect(enc, x+(_xOff), y+(_yOff), rect);                        \
+  EncodeBlock(enc, stats, rect, block, alpha);                          \
   block += 8;                                                           \
-                                                                        \
-  GetAlphaRect(input, width, x+(_xOff), y+(_yOff), rect);               \
-  stb_compress_dxt_block(alpha, (unsigned char*)rect,                   \
-                         0, STB_DXT_HIGHQUAL);                          \
-  SwapDXT(alpha);                                                       \
   alpha += 8
 
-gct_error_t gct_Encode(const gct_header_t *hdr,
-                       const gct_color_t *input, void *output)
+// Encode 8x8 supertile at (x, y) of the rows being encoded
+// into its 4 color blocks and 4 alpha blocks
+static void EncodeTile(const encoder_t *enc, gct_encode_stats_t *stats,
+                       gct_iptr x, gct_iptr y, unsigned char *block,
+                       unsigned char *alpha)
 {
-  gct_iptr x, y;
   gct_color_t rect[16];
+
+  ENCODE_SUBTILE(0, 0);
+  ENCODE_SUBTILE(4, 0);
+  ENCODE_SUBTILE(0, 4);
+  ENCODE_SUBTILE(4, 4);
+}
+
+// Encode rows [yStart, yEnd) of the rows being encoded,
+// both must be multiples of 8
+static void EncodeRows(const encoder_t *enc, gct_encode_stats_t *stats,
+                       gct_iptr yStart, gct_iptr yEnd)
+{
+  const gct_iptr width = enc->width;
+  gct_iptr x, y;
   unsigned char *block, *alpha;
-  gct_i32 width;
-  gct_i32 height;
 
-  // These will give "unused function" warnings otherwise,
-  // kinda wish there was a way to disable their inclusion
-  (void)stb_compress_bc5_block;
-  (void)stb_compress_bc4_block;
+  // Every row of 8x8 supertiles is width*4 bytes long in each plane
+  block = enc->color + ((yStart*width) >> 1);
+  alpha = enc->alpha + ((yStart*width) >> 1);
+  for (y = yStart; y < yEnd; y += 8) {
+    for (x = 0; x < width; x += 8, block += 32, alpha += 32)
+      EncodeTile(enc, stats, x, y, block, alpha);
+  }
+}
 
-  if (!hdr || !input || !output)
-    return gct_ERR_NULL_POINTER;
+// Encode strip of supertile rows, strips are split evenly across
+// the rows so the output doesn't depend on thread scheduling
+static void EncodeStrip(void *arg, int index) {
+  const encoder_t * const enc = (encoder_t*)arg;
+  const gct_iptr rows = enc->numRows >> 3;
+  gct_encode_stats_t stats;
 
-  width = gct_SIGNED_BIG32(hdr->width);
-  height = gct_SIGNED_BIG32(hdr->height);
+  memset(&stats, 0, sizeof(stats));
+  EncodeRows(enc, &stats, (rows*index / enc->numStrips) << 3,
+             (rows*(index+1) / enc->numStrips) << 3);
 
-  if ((width != gct_SIGNED_BIG32(hdr->width2)) ||
-      (height != gct_SIGNED_BIG32(hdr->height2)) ||
-      !ValidImageSize(width, height))
+  if (enc->stripStats) enc->stripStats[index] = stats;
+}
+
+// Convert adaptive threshold of a whole block to an integer,
+// thresholds too big to fit are clamped
+static int AdaptiveThreshold(double err) {
+  if (err >= (double)INT_MAX) return INT_MAX;
+  return (int)err;
+}
+
+// Set up encoder from header and options, opts can't be NULL.
+// Block errors are measured if countBlocks is set
+static gct_error_t InitEncoder(encoder_t *enc, const gct_header_t *hdr,
+                               const gct_encode_options_t *opts,
+                               gct_b32 countBlocks)
+{
+  enc->stripStats = NULL;
+  enc->priorColor = enc->priorAlpha = NULL;
+  enc->blockHashes = NULL;
+  enc->width = gct_SIGNED_BIG32(hdr->width);
+  enc->height = gct_SIGNED_BIG32(hdr->height);
+
+  if ((enc->width != gct_SIGNED_BIG32(hdr->width2)) ||
+      (enc->height != gct_SIGNED_BIG32(hdr->height2)) ||
+      !ValidImageSize(enc->width, enc->height))
     return gct_ERR_INVALID_SIZE;
   else if (!SupportedImageFlags(gct_BIG32(hdr->flags)))
     return gct_ERR_UNSUPPORTED_FLAGS;
 
-  block = (unsigned char*)output;
-  alpha = block + ((width*height) >> 1);
-  for (y = 0; y < height; y += 8) {
-    for (x = 0; x < width; x += 8) {
-      ENCODE_SUBTILE(0, 0);
-      ENCODE_SUBTILE(4, 0);
-      ENCODE_SUBTILE(0, 4);
-      ENCODE_SUBTILE(4, 4);
+  if (opts->colorQuality < 0 || opts->colorQuality >= gct_NUM_QUALITIES ||
+      opts->alphaQuality < 0 || opts->alphaQuality >= gct_NUM_QUALITIES ||
+      !(opts->adaptiveThreshold >= 0.0))
+    return gct_ERR_INVALID_OPTIONS;
+
+  enc->kernels = GetCMPRKernels();
+  enc->colorQuality = opts->colorQuality;
+  enc->alphaQuality = opts->alphaQuality;
+  enc->measureError = countBlocks;
+  enc->flip = opts->flip;
+
+  // Threshold is per pixel and channel, compare against whole blocks
+  enc->colorThreshold = AdaptiveThreshold(opts->adaptiveThreshold * 16*3);
+  enc->alphaThreshold = AdaptiveThreshold(opts->adaptiveThreshold * 16);
+
+  // Never use more threads than there are supertile rows
+  enc->pool = opts->pool;
+  enc->numThreads = enc->pool ? GetPoolSize(enc->pool) : opts->numThreads;
+  if (enc->numThreads <= 0) enc->numThreads = GetCPUCount();
+  if (enc->numThreads > (enc->height >> 3))
+    enc->numThreads = enc->height >> 3;
+
+  return gct_SUCCESS;
+}
+
+// Allocate block counters of every strip
+static gct_error_t AllocStripStats(encoder_t *enc) {
+  enc->stripStats = (gct_encode_stats_t*)
+    malloc(sizeof(gct_encode_stats_t) * enc->numThreads);
+  return enc->stripStats ? gct_SUCCESS : gct_ERR_OUT_OF_MEMORY;
+}
+
+// Add block counters of add to total
+static void AddStats(gct_encode_stats_t *total,
+                     const gct_encode_stats_t *add)
+{
+  total->colorTransparent += add->colorTransparent;
+  total->colorConstant += add->colorConstant;
+  total->colorCompressed += add->colorCompressed;
+  total->alphaConstant += add->alphaConstant;
+  total->alphaCompressed += add->alphaCompressed;
+  total->colorEscalated += add->colorEscalated;
+  total->alphaEscalated += add->alphaEscalated;
+  total->colorError += add->colorError;
+  total->alphaError += add->alphaError;
+  total->blocksKept += add->blocksKept;
+}
+
+// Set earlier version of the image and block hashes from the options,
+// only for encoders writing whole planes in place
+static void SetPrior(encoder_t *enc, const gct_encode_options_t *opts) {
+  enc->priorColor = (const unsigned char*)opts->prior;
+  if (enc->priorColor)
+    enc->priorAlpha = enc->priorColor + ((enc->width*enc->height) >> 1);
+  enc->blockHashes = opts->blockHashes;
+}
+
+// Set rows being encoded, flipped rows are read from the bottom up
+static void SetInput(encoder_t *enc, const gct_image_desc_t *input,
+                     gct_i32 numRows)
+{
+  enc->input = *input;
+  enc->numRows = numRows;
+
+  if (enc->flip) {
+    enc->input.pixels = (const gct_u8*)input->pixels +
+      (numRows-1) * input->stride;
+    enc->input.stride = -input->stride;
+  }
+}
+
+// Encode numRows rows of input into the color and alpha planes,
+// numRows must be a multiple of 8. Block counters are added to total
+static void EncodeBand(encoder_t *enc, gct_encode_stats_t *total,
+                       const gct_image_desc_t *input, unsigned char *color,
+                       unsigned char *alpha, gct_i32 numRows)
+{
+  int i;
+
+  SetInput(enc, input, numRows);
+  enc->color = color;
+  enc->alpha = alpha;
+
+  enc->numStrips = enc->numThreads;
+  if (enc->numStrips > (numRows >> 3)) enc->numStrips = numRows >> 3;
+
+  if (enc->pool) RunPool(enc->pool, enc->numStrips, EncodeStrip, enc);
+  else RunThreads(enc->numStrips, EncodeStrip, enc);
+
+  // Add up counters of every strip
+  if (!enc->stripStats) return;
+  for (i = 0; i < enc->numStrips; ++i)
+    AddStats(total, enc->stripStats + i);
+}
+
+// Turn summed block errors of every encoded block into mean squared errors
+static void FinishStats(gct_encode_stats_t *stats) {
+  // Fully transparent blocks don't count towards color error
+  if (stats->colorConstant + stats->colorCompressed) {
+    stats->colorError /=
+      (double)(stats->colorConstant + stats->colorCompressed) * 16;
+  }
+  if (stats->alphaConstant + stats->alphaCompressed) {
+    stats->alphaError /=
+      (double)(stats->alphaConstant + stats->alphaCompressed) * 16;
+  }
+}
+
+void gct_InitEncodeOptions(gct_encode_options_t *opts) {
+  if (!opts) return;
+
+  opts->numThreads = 1;
+  opts->pool = NULL;
+  opts->stats = NULL;
+  opts->colorQuality = gct_QUALITY_HIGH;
+  opts->alphaQuality = gct_QUALITY_HIGH;
+  opts->adaptiveThreshold = 16.0;
+  opts->flip = gct_false;
+  opts->prior = NULL;
+  opts->blockHashes = NULL;
+}
+
+gct_error_t gct_Encode(const gct_header_t *hdr,
+                       const gct_color_t *input, void *output)
+{
+  return gct_EncodeEx(hdr, input, output, NULL);
+}
+
+// Check that input rows can be read by the encoder
+static gct_error_t CheckImageDesc(const gct_image_desc_t *desc,
+                                  gct_i32 width)
+{
+  gct_iptr rowSize, stride;
+
+  if (!desc->pixels) return gct_ERR_NULL_POINTER;
+
+  switch (desc->format) {
+  case gct_FORMAT_RGBA8:
+  case gct_FORMAT_BGRA8:
+  case gct_FORMAT_RGBA8_PREMUL:
+    rowSize = (gct_iptr)width * 4;
+    break;
+  case gct_FORMAT_RGB8:
+    rowSize = (gct_iptr)width * 3;
+    break;
+  default:
+    return gct_ERR_UNSUPPORTED_FORMAT;
+  }
+
+  // Rows can go upwards, but they can't overlap
+  stride = desc->stride < 0 ? -desc->stride : desc->stride;
+  if (stride < rowSize) return gct_ERR_INVALID_SIZE;
+
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_EncodeEx(const gct_header_t *hdr, const gct_color_t *input,
+                         void *output, const gct_encode_options_t *opts)
+{
+  gct_image_desc_t desc;
+
+  if (!hdr || !input || !output)
+    return gct_ERR_NULL_POINTER;
+
+  desc.pixels = input;
+  desc.stride = (gct_iptr)gct_SIGNED_BIG32(hdr->width) * 4;
+  desc.format = gct_FORMAT_RGBA8;
+
+  return gct_EncodeImage(hdr, &desc, output, opts);
+}
+
+gct_error_t gct_EncodeImage(const gct_header_t *hdr,
+                            const gct_image_desc_t *input, void *output,
+                            const gct_encode_options_t *opts)
+{
+  encoder_t enc;
+  gct_encode_options_t defaultOpts;
+  gct_encode_stats_t total;
+  unsigned char * const color = (unsigned char*)output;
+  gct_error_t err;
+
+  if (!hdr || !input || !output)
+    return gct_ERR_NULL_POINTER;
+
+  if (!opts) {
+    gct_InitEncodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  err = InitEncoder(&enc, hdr, opts, opts->stats != NULL);
+  if (!err) err = CheckImageDesc(input, enc.width);
+  if (!err && opts->stats) err = AllocStripStats(&enc);
+  if (!err) SetPrior(&enc, opts);
+  if (err) {
+    free(enc.stripStats);
+    return err;
+  }
+
+  memset(&total, 0, sizeof(total));
+  EncodeBand(&enc, &total, input, color,
+             color + ((enc.width*enc.height) >> 1), enc.height);
+
+  if (opts->stats) {
+    FinishStats(&total);
+    *opts->stats = total;
+  }
+
+  free(enc.stripStats);
+  return gct_SUCCESS;
+}
+
+// Supertiles encoded again by gct_EncodeRects
+typedef struct dirty_s {
+  const encoder_t *enc;
+
+  // Index of each supertile in the planes, in the order they're stored
+  gct_iptr *tiles;
+  gct_iptr numTiles;
+} dirty_t;
+
+// Encode strip of the supertiles that changed, tiles are split
+// evenly between strips however they're spread over the image
+static void EncodeDirtyStrip(void *arg, int index) {
+  const dirty_t * const dirty = (dirty_t*)arg;
+  const encoder_t * const enc = dirty->enc;
+  const gct_iptr tilesX = enc->width >> 3;
+  const gct_iptr end = dirty->numTiles*(index+1) / enc->numStrips;
+  gct_encode_stats_t stats;
+  gct_iptr i, t;
+
+  memset(&stats, 0, sizeof(stats));
+  for (i = dirty->numTiles*index / enc->numStrips; i < end; ++i) {
+    t = dirty->tiles[i];
+    EncodeTile(enc, &stats, (t % tilesX) << 3, (t / tilesX) << 3,
+               enc->color + t*32, enc->alpha + t*32);
+  }
+
+  if (enc->stripStats) enc->stripStats[index] = stats;
+}
+
+// Mark every supertile overlapping a rectangle, and count the ones
+// that weren't marked yet. Rectangles are clipped to the image
+static gct_iptr MarkRect(const encoder_t *enc, const gct_rect_t *rect,
+                         gct_u8 *marks)
+{
+  const gct_iptr tilesX = enc->width >> 3;
+  gct_iptr x0 = rect->x, y0 = rect->y, x1, y1, tmp, x, y, count = 0;
+
+  x1 = x0 + rect->width;
+  y1 = y0 + rect->height;
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 > enc->width) x1 = enc->width;
+  if (y1 > enc->height) y1 = enc->height;
+  if (x0 >= x1 || y0 >= y1) return 0;
+
+  // Rows of the rectangle are upright, supertiles are stored bottom-up
+  if (enc->flip) {
+    tmp = y0;
+    y0 = enc->height - y1;
+    y1 = enc->height - tmp;
+  }
+
+  for (y = y0 >> 3; y < (y1 + 7) >> 3; ++y) {
+    for (x = x0 >> 3; x < (x1 + 7) >> 3; ++x) {
+      count += !marks[y*tilesX + x];
+      marks[y*tilesX + x] = 1;
+    }
+  }
+
+  return count;
+}
+
+gct_error_t gct_EncodeRects(const gct_header_t *hdr,
+                            const gct_image_desc_t *input, void *output,
+                            const gct_rect_t *rects, gct_uptr numRects,
+                            const gct_encode_options_t *opts)
+{
+  encoder_t enc;
+  gct_encode_options_t defaultOpts;
+  gct_encode_stats_t total;
+  dirty_t dirty;
+  gct_u8 *marks = NULL;
+  gct_iptr numTiles, t;
+  gct_uptr i;
+  gct_error_t err;
+
+  if (!hdr || !input || !output || (numRects && !rects))
+    return gct_ERR_NULL_POINTER;
+
+  if (!opts) {
+    gct_InitEncodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  err = InitEncoder(&enc, hdr, opts, opts->stats != NULL);
+  if (!err) err = CheckImageDesc(input, enc.width);
+  if (!err && opts->stats) err = AllocStripStats(&enc);
+  if (!err) SetPrior(&enc, opts);
+  if (err) goto done;
+
+  numTiles = (gct_iptr)(enc.width >> 3) * (enc.height >> 3);
+  dirty.enc = &enc;
+  dirty.tiles = NULL;
+  dirty.numTiles = 0;
+
+  marks = (gct_u8*)calloc((gct_uptr)numTiles, 1);
+  if (!marks) {
+    err = gct_ERR_OUT_OF_MEMORY;
+    goto done;
+  }
+
+  for (i = 0; i < numRects; ++i)
+    dirty.numTiles += MarkRect(&enc, rects + i, marks);
+
+  memset(&total, 0, sizeof(total));
+  if (dirty.numTiles) {
+    dirty.tiles = (gct_iptr*)malloc(sizeof(gct_iptr) * dirty.numTiles);
+    if (!dirty.tiles) {
+      err = gct_ERR_OUT_OF_MEMORY;
+      goto done;
+    }
+
+    dirty.numTiles = 0;
+    for (t = 0; t < numTiles; ++t) {
+      if (marks[t]) dirty.tiles[dirty.numTiles++] = t;
+    }
+
+    SetInput(&enc, input, enc.height);
+    enc.color = (unsigned char*)output;
+    enc.alpha = enc.color + ((enc.width*enc.height) >> 1);
+
+    enc.numStrips = enc.numThreads;
+    if (enc.numStrips > dirty.numTiles) enc.numStrips = (int)dirty.numTiles;
+
+    if (enc.pool) RunPool(enc.pool, enc.numStrips, EncodeDirtyStrip, &dirty);
+    else RunThreads(enc.numStrips, EncodeDirtyStrip, &dirty);
+
+    if (enc.stripStats) {
+      for (t = 0; t < enc.numStrips; ++t)
+        AddStats(&total, enc.stripStats + t);
     }
   }
 
+  if (opts->stats) {
+    FinishStats(&total);
+    *opts->stats = total;
+  }
+
+  free(dirty.tiles);
+
+done:
+  free(marks);
+  free(enc.stripStats);
+  return err;
+}
+
+// Pixels encoded by each batch task, images at least twice
+// as big are split into strips, smaller ones are grouped together
+#define BATCH_TASK_PIXELS (256*256)
+
+// Part of a batch run by one thread, either rows [yStart, yEnd)
+// of a single image, or every row of images [job, job+numJobs)
+// when there's more than one
+typedef struct batch_task_s {
+  gct_uptr job, numJobs;
+  gct_i32 yStart, yEnd;
+
+  // Block counters of a strip of a single image
+  gct_encode_stats_t stats;
+} batch_task_t;
+
+typedef struct batch_s {
+  const gct_encode_job_t *jobs;
+  encoder_t *encs;
+  batch_task_t *tasks;
+
+  // Block counters of each image
+  gct_encode_stats_t *totals;
+} batch_t;
+
+// Encode rows of every image of a batch task
+static void EncodeBatchTask(void *arg, int index) {
+  const batch_t * const batch = (batch_t*)arg;
+  batch_task_t * const task = batch->tasks + index;
+  gct_uptr i;
+
+  if (task->numJobs == 1) {
+    memset(&task->stats, 0, sizeof(task->stats));
+    EncodeRows(batch->encs + task->job, &task->stats,
+               task->yStart, task->yEnd);
+    return;
+  }
+
+  // Grouped images aren't split, so counters go straight to the image
+  for (i = task->job; i < task->job + task->numJobs; ++i) {
+    if (batch->jobs[i].result) continue;
+
+    EncodeRows(batch->encs + i, batch->totals + i, 0, batch->encs[i].height);
+  }
+}
+
+// Rows in each strip of an image that's split across batch tasks
+static gct_i32 BatchStripRows(gct_i32 width) {
+  const gct_i32 rows = (gct_i32)((BATCH_TASK_PIXELS / width) & ~7);
+  return rows < 8 ? 8 : rows;
+}
+
+// Split batch into tasks, returns number of tasks. tasks needs room
+// for a task per image, plus a task per strip of split images
+static int SplitBatch(const gct_encode_job_t *jobs, const encoder_t *encs,
+                      gct_uptr numJobs, batch_task_t *tasks)
+{
+  gct_uptr i, pixels = 0;
+  gct_i32 y, rows;
+  int numTasks = 0;
+
+  for (i = 0; i < numJobs; ++i) {
+    if (jobs[i].result) continue;
+
+    // Start a new group once the current one is big enough
+    if (pixels >= BATCH_TASK_PIXELS) pixels = 0;
+
+    if ((gct_uptr)encs[i].width * encs[i].height < BATCH_TASK_PIXELS*2) {
+      if (!pixels) {
+        tasks[numTasks].job = i;
+        tasks[numTasks].yStart = 0;
+        tasks[numTasks].yEnd = encs[i].height;
+        ++numTasks;
+      }
+
+      // Groups are contiguous, images that failed are skipped over
+      tasks[numTasks-1].numJobs = i+1 - tasks[numTasks-1].job;
+      pixels += (gct_uptr)encs[i].width * encs[i].height;
+      continue;
+    }
+
+    rows = BatchStripRows(encs[i].width);
+    for (y = 0; y < encs[i].height; y += rows, ++numTasks) {
+      tasks[numTasks].job = i;
+      tasks[numTasks].numJobs = 1;
+      tasks[numTasks].yStart = y;
+      tasks[numTasks].yEnd = y+rows < encs[i].height ? y+rows : encs[i].height;
+    }
+    pixels = 0;
+  }
+
+  return numTasks;
+}
+
+gct_error_t gct_EncodeBatch(gct_encode_job_t *jobs, gct_uptr numJobs,
+                            const gct_encode_options_t *opts)
+{
+  batch_t batch;
+  gct_encode_options_t defaultOpts;
+  gct_thread_pool_t *pool;
+  encoder_t *enc;
+  unsigned char *color;
+  gct_uptr i, maxTasks = 0;
+  int numTasks, t;
+  gct_error_t err;
+
+  if (!jobs) return gct_ERR_NULL_POINTER;
+  else if (!numJobs) return gct_SUCCESS;
+
+  if (!opts) {
+    gct_InitEncodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  // Jobs are checked once work is allocated, so any job that's still
+  // successful when allocation fails gets the error
+  for (i = 0; i < numJobs; ++i) jobs[i].result = gct_SUCCESS;
+
+  batch.jobs = jobs;
+  batch.encs = (encoder_t*)malloc(sizeof(encoder_t) * numJobs);
+  batch.totals = (gct_encode_stats_t*)
+    calloc(numJobs, sizeof(gct_encode_stats_t));
+  if (!batch.encs || !batch.totals) {
+    err = gct_ERR_OUT_OF_MEMORY;
+    goto fail;
+  }
+
+  for (i = 0; i < numJobs; ++i) {
+    enc = batch.encs + i;
+
+    if (!jobs[i].hdr || !jobs[i].output) {
+      jobs[i].result = gct_ERR_NULL_POINTER;
+      continue;
+    }
+
+    jobs[i].result = InitEncoder(enc, jobs[i].hdr, opts, jobs[i].stats != NULL);
+    if (!jobs[i].result)
+      jobs[i].result = CheckImageDesc(&jobs[i].input, enc->width);
+    if (jobs[i].result) continue;
+
+    color = (unsigned char*)jobs[i].output;
+    SetInput(enc, &jobs[i].input, enc->height);
+    enc->color = color;
+    enc->alpha = color + ((enc->width*enc->height) >> 1);
+
+    maxTasks += 1 + enc->height / BatchStripRows(enc->width);
+  }
+
+  batch.tasks = (batch_task_t*)malloc(sizeof(batch_task_t) * (maxTasks+1));
+  if (!batch.tasks) {
+    err = gct_ERR_OUT_OF_MEMORY;
+    goto fail;
+  }
+  numTasks = SplitBatch(jobs, batch.encs, numJobs, batch.tasks);
+
+  // Batches have plenty of work to share, so the temporary pool
+  // uses every logical processor unless more than one thread is asked for
+  pool = opts->pool;
+  if (!pool) {
+    err = gct_CreateThreadPool(&pool,
+                               opts->numThreads > 1 ? opts->numThreads : 0);
+    if (err) {
+      free(batch.tasks);
+      goto fail;
+    }
+  }
+
+  RunPool(pool, numTasks, EncodeBatchTask, &batch);
+
+  if (!opts->pool) gct_DestroyThreadPool(pool);
+
+  // Add up counters of split images
+  for (t = 0; t < numTasks; ++t) {
+    if (batch.tasks[t].numJobs == 1)
+      AddStats(batch.totals + batch.tasks[t].job, &batch.tasks[t].stats);
+  }
+
+  err = gct_SUCCESS;
+  for (i = 0; i < numJobs; ++i) {
+    if (jobs[i].result) {
+      if (!err) err = jobs[i].result;
+      continue;
+    }
+
+    if (jobs[i].stats) {
+      FinishStats(batch.totals + i);
+      *jobs[i].stats = batch.totals[i];
+    }
+  }
+
+  free(batch.tasks);
+  free(batch.encs);
+  free(batch.totals);
+  return err;
+
+fail:
+  for (i = 0; i < numJobs; ++i) {
+    if (!jobs[i].result) jobs[i].result = err;
+  }
+
+  free(batch.encs);
+  free(batch.totals);
+  return err;
+}
+
+// Streaming encoder, rows are encoded as they're fed in
+struct gct_encode_stream_s {
+  encoder_t enc;
+
+  // Output of the whole image, NULL when writing to sinks
+  unsigned char *output;
+
+  // Sinks of each plane, and a buffer holding the
+  // blocks of the rows being encoded for each of them
+  gct_sink_t colorSink, alphaSink;
+  unsigned char *buffer;
+  gct_uptr bufferSize;
+
+  // Block counters of every row so far, and where they go
+  gct_encode_stats_t total, *stats;
+
+  // Next row to be encoded
+  gct_i32 row;
+
+  // First error returned by a sink, every call after it fails
+  gct_error_t err;
+};
+
+// Allocate stream and set up its encoder
+static gct_error_t BeginStream(gct_encode_stream_t **stream,
+                               const gct_header_t *hdr,
+                               const gct_encode_options_t *opts)
+{
+  gct_encode_stream_t *s;
+  gct_encode_options_t defaultOpts;
+  gct_error_t err;
+
+  if (!opts) {
+    gct_InitEncodeOptions(&defaultOpts);
+    opts = &defaultOpts;
+  }
+
+  s = (gct_encode_stream_t*)malloc(sizeof(gct_encode_stream_t));
+  if (!s) return gct_ERR_OUT_OF_MEMORY;
+
+  err = InitEncoder(&s->enc, hdr, opts, opts->stats != NULL);
+  if (!err && opts->stats) err = AllocStripStats(&s->enc);
+  if (err) {
+    free(s);
+    return err;
+  }
+
+  s->output = NULL;
+  s->buffer = NULL;
+  s->bufferSize = 0;
+  memset(&s->total, 0, sizeof(s->total));
+  s->stats = opts->stats;
+  s->row = 0;
+  s->err = gct_SUCCESS;
+
+  *stream = s;
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_BeginEncode(gct_encode_stream_t **stream,
+                            const gct_header_t *hdr, void *output,
+                            const gct_encode_options_t *opts)
+{
+  gct_error_t err;
+
+  if (!stream || !hdr || !output)
+    return gct_ERR_NULL_POINTER;
+
+  err = BeginStream(stream, hdr, opts);
+  if (err) return err;
+
+  (*stream)->output = (unsigned char*)output;
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_BeginEncodeToSinks(gct_encode_stream_t **stream,
+                                   const gct_header_t *hdr,
+                                   const gct_sink_t *colorSink,
+                                   const gct_sink_t *alphaSink,
+                                   const gct_encode_options_t *opts)
+{
+  gct_error_t err;
+
+  if (!stream || !hdr || !colorSink || !alphaSink ||
+      !colorSink->write || !alphaSink->write)
+    return gct_ERR_NULL_POINTER;
+
+  err = BeginStream(stream, hdr, opts);
+  if (err) return err;
+
+  (*stream)->colorSink = *colorSink;
+  (*stream)->alphaSink = *alphaSink;
   return gct_SUCCESS;
 }
+
+gct_error_t gct_EncodeRows(gct_encode_stream_t *stream,
+                           const gct_color_t *rows, int numRows)
+{
+  gct_image_desc_t desc;
+
+  if (!stream || !rows)
+    return gct_ERR_NULL_POINTER;
+
+  desc.pixels = rows;
+  desc.stride = (gct_iptr)stream->enc.width * 4;
+  desc.format = gct_FORMAT_RGBA8;
+
+  return gct_EncodeImageRows(stream, &desc, numRows);
+}
+
+gct_error_t gct_EncodeImageRows(gct_encode_stream_t *stream,
+                                const gct_image_desc_t *rows, int numRows)
+{
+  encoder_t *enc;
+  unsigned char *buffer;
+  gct_uptr offset, size;
+  gct_error_t err;
+
+  if (!stream || !rows)
+    return gct_ERR_NULL_POINTER;
+  else if (stream->err)
+    return stream->err;
+
+  enc = &stream->enc;
+  if (numRows <= 0 || (numRows & 7) || numRows > enc->height - stream->row)
+    return gct_ERR_INVALID_SIZE;
+
+  err = CheckImageDesc(rows, enc->width);
+  if (err) return err;
+
+  // Blocks of these rows start here in each plane, flipped
+  // images are stored from the bottom of the planes up
+  offset = ((gct_uptr)(enc->flip ? enc->height - stream->row - numRows :
+                       stream->row) * enc->width) >> 1;
+  size = ((gct_uptr)numRows * enc->width) >> 1;
+
+  if (stream->output) {
+    EncodeBand(enc, &stream->total, rows, stream->output + offset,
+               stream->output + (((gct_uptr)enc->width*enc->height) >> 1) +
+               offset, numRows);
+  } else {
+    // Buffer only ever grows to the most rows fed at once
+    if (size*2 > stream->bufferSize) {
+      buffer = (unsigned char*)realloc(stream->buffer, size*2);
+      if (!buffer) return gct_ERR_OUT_OF_MEMORY;
+
+      stream->buffer = buffer;
+      stream->bufferSize = size*2;
+    }
+
+    EncodeBand(enc, &stream->total, rows, stream->buffer,
+               stream->buffer + size, numRows);
+
+    stream->err = stream->colorSink.write(stream->colorSink.user, offset,
+                                          stream->buffer, size);
+    if (!stream->err) {
+      stream->err = stream->alphaSink.write(stream->alphaSink.user, offset,
+                                            stream->buffer + size, size);
+    }
+    if (stream->err) return stream->err;
+  }
+
+  stream->row += numRows;
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_EndEncode(gct_encode_stream_t *stream) {
+  gct_error_t err;
+
+  if (!stream) return gct_ERR_NULL_POINTER;
+
+  err = stream->err;
+  if (!err && stream->row < stream->enc.height)
+    err = gct_ERR_INCOMPLETE_IMAGE;
+
+  if (!err && stream->stats) {
+    FinishStats(&stream->total);
+    *stream->stats = stream->total;
+  }
+
+  free(stream->enc.stripStats);
+  free(stream->buffer);
+  free(stream);
+
+  return err;
+}
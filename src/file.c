@@ -0,0 +1,204 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  GCT file handles, mapped from disk or wrapping a buffer
+ *
+ ******************************************************************************/
+
+// Needed for mmap with strict C99
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gct/gctlib.h"
+#include "common.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct gct_file_s {
+  gct_file_info_t info;
+
+  // File was mapped by gct_OpenFile, and has to be unmapped
+  gct_b32 mapped;
+#ifdef _WIN32
+  HANDLE handle, mapping;
+#endif
+};
+
+// Check header and size of the file, and find its planes
+static gct_error_t ReadFileInfo(gct_file_info_t *info) {
+  const gct_header_t * const hdr = (const gct_header_t*)info->data;
+  gct_i32 width, height;
+  gct_error_t err;
+
+  if (info->size < sizeof(gct_header_t))
+    return gct_ERR_INVALID_IMAGE;
+
+  err = ReadImageHeader(hdr, &width, &height);
+  if (err) return err;
+
+  // Both planes have to be in the file
+  info->planeSize = ((gct_uptr)width*height) >> 1;
+  if (info->size - sizeof(gct_header_t) < info->planeSize*2)
+    return gct_ERR_INVALID_IMAGE;
+
+  info->width = width;
+  info->height = height;
+  info->flags = gct_BIG32(hdr->flags);
+  info->flipped = ImageFlipped(hdr);
+  info->color = hdr+1;
+  info->alpha = (const gct_u8*)info->color + info->planeSize;
+
+  return gct_SUCCESS;
+}
+
+// Map whole file into memory, for reading only
+static gct_error_t MapFile(gct_file_t *f, const char *path) {
+#ifdef _WIN32
+  LARGE_INTEGER size;
+
+  f->handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f->handle == INVALID_HANDLE_VALUE)
+    return gct_ERR_FILE_ACCESS;
+
+  if (!GetFileSizeEx(f->handle, &size)) {
+    CloseHandle(f->handle);
+    return gct_ERR_FILE_ACCESS;
+  }
+
+  // Empty files can't be mapped
+  if ((gct_uptr)size.QuadPart < sizeof(gct_header_t)) {
+    CloseHandle(f->handle);
+    return gct_ERR_INVALID_IMAGE;
+  }
+
+  f->mapping = CreateFileMappingA(f->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!f->mapping) {
+    CloseHandle(f->handle);
+    return gct_ERR_FILE_ACCESS;
+  }
+
+  f->info.data = MapViewOfFile(f->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!f->info.data) {
+    CloseHandle(f->mapping);
+    CloseHandle(f->handle);
+    return gct_ERR_FILE_ACCESS;
+  }
+
+  f->info.size = (gct_uptr)size.QuadPart;
+#else
+  struct stat st;
+  void *data;
+  const int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return gct_ERR_FILE_ACCESS;
+
+  if (fstat(fd, &st)) {
+    close(fd);
+    return gct_ERR_FILE_ACCESS;
+  }
+
+  // Empty files can't be mapped
+  if ((gct_uptr)st.st_size < sizeof(gct_header_t)) {
+    close(fd);
+    return gct_ERR_INVALID_IMAGE;
+  }
+
+  // Mapping stays around after the file is closed
+  data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return gct_ERR_FILE_ACCESS;
+
+  f->info.data = data;
+  f->info.size = (gct_uptr)st.st_size;
+#endif
+
+  f->mapped = gct_true;
+  return gct_SUCCESS;
+}
+
+// Unmap file mapped by MapFile
+static void UnmapFile(gct_file_t *f) {
+#ifdef _WIN32
+  UnmapViewOfFile(f->info.data);
+  CloseHandle(f->mapping);
+  CloseHandle(f->handle);
+#else
+  munmap((void*)f->info.data, f->info.size);
+#endif
+}
+
+gct_error_t gct_OpenFile(gct_file_t **file, const char *path) {
+  gct_file_t *f;
+  gct_error_t err;
+
+  if (!file || !path) return gct_ERR_NULL_POINTER;
+
+  f = (gct_file_t*)malloc(sizeof(gct_file_t));
+  if (!f) return gct_ERR_OUT_OF_MEMORY;
+
+  err = MapFile(f, path);
+  if (err) {
+    free(f);
+    return err;
+  }
+
+  err = ReadFileInfo(&f->info);
+  if (err) {
+    gct_CloseFile(f);
+    return err;
+  }
+
+  *file = f;
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_OpenMemory(gct_file_t **file, const void *data,
+                           gct_uptr size)
+{
+  gct_file_t *f;
+  gct_error_t err;
+
+  if (!file || !data) return gct_ERR_NULL_POINTER;
+
+  f = (gct_file_t*)malloc(sizeof(gct_file_t));
+  if (!f) return gct_ERR_OUT_OF_MEMORY;
+
+  f->mapped = gct_false;
+  f->info.data = data;
+  f->info.size = size;
+
+  err = ReadFileInfo(&f->info);
+  if (err) {
+    free(f);
+    return err;
+  }
+
+  *file = f;
+  return gct_SUCCESS;
+}
+
+void gct_CloseFile(gct_file_t *file) {
+  if (!file) return;
+
+  if (file->mapped) UnmapFile(file);
+  free(file);
+}
+
+const gct_file_info_t *gct_GetFileInfo(const gct_file_t *file) {
+  return &file->info;
+}
@@ -18,6 +18,11 @@ const char *gct_StrError(gct_error_t err) {
     "Invalid NULL pointer", // gct_ERR_NULL_POINTER
     "Unsupported image file", // gct_ERR_UNSUPPORTED_IMAGE
     "Invalid image file", // gct_ERR_INVALID_IMAGE
+    "Out of memory", // gct_ERR_OUT_OF_MEMORY
+    "Invalid options", // gct_ERR_INVALID_OPTIONS
+    "Image is incomplete", // gct_ERR_INCOMPLETE_IMAGE
+    "Unsupported pixel format", // gct_ERR_UNSUPPORTED_FORMAT
+    "Cannot access file", // gct_ERR_FILE_ACCESS
   };
 
   if (err < 0) err = -err;
@@ -0,0 +1,267 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  BC1 and DDS importer
+ *  BC1 color blocks become CMPR blocks by swapping the bytes of their
+ *  endpoints and reversing the indices of each row, so they're moved
+ *  into supertiles as they are
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "common.h"
+#include "cmpr.h"
+
+#include <string.h>
+
+// Index byte of a CMPR alpha block for a row of a BC1 block in 3 color
+// mode, pixels using index 3 (transparent) get index 1 and the rest 0
+static const gct_u8 TransparentIndices[256] = {
+  0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40,
+  0x10, 0x10, 0x10, 0x50, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40,
+  0x00, 0x00, 0x00, 0x40, 0x10, 0x10, 0x10, 0x50, 0x00, 0x00, 0x00, 0x40,
+  0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x10, 0x10, 0x10, 0x50,
+  0x04, 0x04, 0x04, 0x44, 0x04, 0x04, 0x04, 0x44, 0x04, 0x04, 0x04, 0x44,
+  0x14, 0x14, 0x14, 0x54, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40,
+  0x00, 0x00, 0x00, 0x40, 0x10, 0x10, 0x10, 0x50, 0x00, 0x00, 0x00, 0x40,
+  0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x10, 0x10, 0x10, 0x50,
+  0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40,
+  0x10, 0x10, 0x10, 0x50, 0x04, 0x04, 0x04, 0x44, 0x04, 0x04, 0x04, 0x44,
+  0x04, 0x04, 0x04, 0x44, 0x14, 0x14, 0x14, 0x54, 0x00, 0x00, 0x00, 0x40,
+  0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x10, 0x10, 0x10, 0x50,
+  0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40,
+  0x10, 0x10, 0x10, 0x50, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x40,
+  0x00, 0x00, 0x00, 0x40, 0x10, 0x10, 0x10, 0x50, 0x04, 0x04, 0x04, 0x44,
+  0x04, 0x04, 0x04, 0x44, 0x04, 0x04, 0x04, 0x44, 0x14, 0x14, 0x14, 0x54,
+  0x01, 0x01, 0x01, 0x41, 0x01, 0x01, 0x01, 0x41, 0x01, 0x01, 0x01, 0x41,
+  0x11, 0x11, 0x11, 0x51, 0x01, 0x01, 0x01, 0x41, 0x01, 0x01, 0x01, 0x41,
+  0x01, 0x01, 0x01, 0x41, 0x11, 0x11, 0x11, 0x51, 0x01, 0x01, 0x01, 0x41,
+  0x01, 0x01, 0x01, 0x41, 0x01, 0x01, 0x01, 0x41, 0x11, 0x11, 0x11, 0x51,
+  0x05, 0x05, 0x05, 0x45, 0x05, 0x05, 0x05, 0x45, 0x05, 0x05, 0x05, 0x45,
+  0x15, 0x15, 0x15, 0x55
+};
+
+// Importer state
+typedef struct importer_s {
+  const gct_bc1_source_t *src;
+  gct_i32 width, height;
+  const cmpr_kernels_t *kernels;
+} importer_t;
+
+// Convert BC1 block to a CMPR block
+static void ReadBC1(gct_u8 *dest, const gct_u8 *src) {
+  dest[0] = src[1];
+  dest[1] = src[0];
+  dest[2] = src[3];
+  dest[3] = src[2];
+  dest[4] = ReverseIndices[src[4]];
+  dest[5] = ReverseIndices[src[5]];
+  dest[6] = ReverseIndices[src[6]];
+  dest[7] = ReverseIndices[src[7]];
+}
+
+// Write alpha block from the 1-bit alpha of a BC1 block, the endpoints
+// are 255 then 0, so opaque pixels are index 0 and transparent ones 1
+static void ReadPunchthrough(gct_u8 *dest, const gct_u8 *src) {
+  const gct_b32 threeColor =
+    (src[0] | (src[1] << 8)) <= (src[2] | (src[3] << 8));
+
+  dest[0] = 0x07;
+  dest[1] = 0xe0;
+  dest[2] = 0;
+  dest[3] = 0;
+  dest[4] = threeColor ? TransparentIndices[src[4]] : 0;
+  dest[5] = threeColor ? TransparentIndices[src[5]] : 0;
+  dest[6] = threeColor ? TransparentIndices[src[6]] : 0;
+  dest[7] = threeColor ? TransparentIndices[src[7]] : 0;
+}
+
+// Get the 16 alpha values of a BC4 block
+static void ReadBC4(gct_u8 *alpha, const gct_u8 *src) {
+  const int a0 = src[0], a1 = src[1];
+  int lv[8], i;
+  gct_u32 lo, hi;
+
+  lv[0] = a0;
+  lv[1] = a1;
+  if (a0 > a1) {
+    for (i = 1; i < 7; ++i)
+      lv[i+1] = ((7-i)*a0 + i*a1 + 3) / 7;
+  } else {
+    for (i = 1; i < 5; ++i)
+      lv[i+1] = ((5-i)*a0 + i*a1 + 2) / 5;
+    lv[6] = 0;
+    lv[7] = 255;
+  }
+
+  // 3-bit indices, first pixel in the low bits
+  lo = src[2] | (src[3] << 8) | ((gct_u32)src[4] << 16);
+  hi = src[5] | (src[6] << 8) | ((gct_u32)src[7] << 16);
+  for (i = 0; i < 8; ++i) {
+    alpha[i] = (gct_u8)lv[(lo >> (i*3)) & 7];
+    alpha[i+8] = (gct_u8)lv[(hi >> (i*3)) & 7];
+  }
+}
+
+// Write color and alpha blocks of block (x, y) of the image
+static void ImportBlock(const importer_t *imp, gct_i32 x, gct_i32 y,
+                        gct_u8 *color, gct_u8 *alpha)
+{
+  const gct_bc1_source_t * const src = imp->src;
+  const gct_iptr index = (gct_iptr)y*(imp->width >> 2) + x;
+  const gct_u8 * const block = (const gct_u8*)src->color + index*8;
+  const gct_u8 *arow;
+  gct_u8 values[16];
+  int i;
+
+  ReadBC1(color, block);
+
+  switch (src->alphaSource) {
+  case gct_ALPHA_PUNCHTHROUGH:
+    ReadPunchthrough(alpha, block);
+    return;
+
+  case gct_ALPHA_BC1:
+    ReadBC1(alpha, (const gct_u8*)src->alpha + index*8);
+    return;
+
+  case gct_ALPHA_BC4:
+    ReadBC4(values, (const gct_u8*)src->alpha + index*8);
+    break;
+
+  case gct_ALPHA_RAW:
+    arow = (const gct_u8*)src->alpha + (gct_iptr)y*4*src->alphaStride + x*4;
+    for (i = 0; i < 4; ++i, arow += src->alphaStride) {
+      values[i*4] = arow[0];
+      values[i*4 + 1] = arow[1];
+      values[i*4 + 2] = arow[2];
+      values[i*4 + 3] = arow[3];
+    }
+    break;
+  }
+
+  CompressAlphaBlock(imp->kernels, alpha, values, src->alphaQuality);
+}
+
+gct_error_t gct_ImportBC1(const gct_header_t *hdr,
+                          const gct_bc1_source_t *src, void *output)
+{
+  importer_t imp;
+  gct_u8 *color, *alpha;
+  gct_i32 x, y, i, sy;
+  gct_b32 flipped;
+
+  if (!hdr || !src || !src->color || !output ||
+      (src->alphaSource != gct_ALPHA_PUNCHTHROUGH && !src->alpha))
+    return gct_ERR_NULL_POINTER;
+
+  imp.width = gct_SIGNED_BIG32(hdr->width);
+  imp.height = gct_SIGNED_BIG32(hdr->height);
+
+  if ((imp.width != gct_SIGNED_BIG32(hdr->width2)) ||
+      (imp.height != gct_SIGNED_BIG32(hdr->height2)) ||
+      !ValidImageSize(imp.width, imp.height))
+    return gct_ERR_INVALID_SIZE;
+  else if (!SupportedImageFlags(gct_BIG32(hdr->flags)))
+    return gct_ERR_UNSUPPORTED_FLAGS;
+
+  if (src->alphaSource < 0 || src->alphaSource >= gct_NUM_ALPHA_SOURCES ||
+      src->alphaQuality < 0 || src->alphaQuality >= gct_QUALITY_ADAPTIVE)
+    return gct_ERR_INVALID_OPTIONS;
+
+  imp.src = src;
+  imp.kernels = GetCMPRKernels();
+  flipped = ImageFlipped(hdr);
+
+  // Blocks of a supertile are top left, top right,
+  // bottom left, then bottom right. Rows of bottom-up images are
+  // filled from the bottom of the source, with every block flipped
+  color = (gct_u8*)output;
+  alpha = color + ((imp.width*imp.height) >> 1);
+  for (y = 0; y < imp.height >> 2; y += 2) {
+    for (x = 0; x < imp.width >> 2; x += 2) {
+      for (i = 0; i < 4; ++i, color += 8, alpha += 8) {
+        sy = y + (i >> 1);
+        if (!flipped) {
+          ImportBlock(&imp, x + (i & 1), sy, color, alpha);
+          continue;
+        }
+
+        ImportBlock(&imp, x + (i & 1), (imp.height >> 2) - 1 - sy,
+                    color, alpha);
+        FlipBlock(color, color);
+        FlipBlock(alpha, alpha);
+      }
+    }
+  }
+
+  return gct_SUCCESS;
+}
+
+// Read 32-bit little endian value of a DDS header
+#define DDS_READ32(_p) ((gct_u32)(_p)[0] | ((gct_u32)(_p)[1] << 8) | \
+                        ((gct_u32)(_p)[2] << 16) | ((gct_u32)(_p)[3] << 24))
+
+// Fields of the DDS header, as offsets from the start of the file
+#define DDS_MAGIC    0
+#define DDS_SIZE     4
+#define DDS_HEIGHT   12
+#define DDS_WIDTH    16
+#define DDS_PF_FLAGS 80
+#define DDS_FOURCC   84
+#define DDS_DXGI     128
+
+// Size of the DDS header, and the extra header of DX10 files
+#define DDS_HEADER_SIZE 128
+#define DDS_DX10_SIZE   20
+
+// Pixel format has a four character code
+#define DDPF_FOURCC 0x4
+
+// DXGI_FORMAT_BC1_UNORM and DXGI_FORMAT_BC1_UNORM_SRGB
+#define DXGI_BC1      71
+#define DXGI_BC1_SRGB 72
+
+gct_error_t gct_ReadDDS(const void *dds, gct_uptr size, int *width,
+                        int *height, const void **blocks)
+{
+  const gct_u8 * const p = (const gct_u8*)dds;
+  gct_uptr offset = DDS_HEADER_SIZE;
+  gct_u32 w, h;
+
+  if (!dds || !width || !height || !blocks)
+    return gct_ERR_NULL_POINTER;
+
+  if (size < DDS_HEADER_SIZE ||
+      p[0] != 'D' || p[1] != 'D' || p[2] != 'S' || p[3] != ' ' ||
+      DDS_READ32(p + DDS_SIZE) != DDS_HEADER_SIZE - 4)
+    return gct_ERR_INVALID_IMAGE;
+
+  if (!(DDS_READ32(p + DDS_PF_FLAGS) & DDPF_FOURCC))
+    return gct_ERR_UNSUPPORTED_IMAGE;
+
+  if (!memcmp(p + DDS_FOURCC, "DX10", 4)) {
+    if (size < DDS_HEADER_SIZE + DDS_DX10_SIZE)
+      return gct_ERR_INVALID_IMAGE;
+    else if (DDS_READ32(p + DDS_DXGI) != DXGI_BC1 &&
+             DDS_READ32(p + DDS_DXGI) != DXGI_BC1_SRGB)
+      return gct_ERR_UNSUPPORTED_IMAGE;
+
+    offset += DDS_DX10_SIZE;
+  } else if (memcmp(p + DDS_FOURCC, "DXT1", 4))
+    return gct_ERR_UNSUPPORTED_IMAGE;
+
+  w = DDS_READ32(p + DDS_WIDTH);
+  h = DDS_READ32(p + DDS_HEIGHT);
+  if (!w || !h || w > 0x7fff || h > 0x7fff ||
+      size - offset < (gct_uptr)((w+3) >> 2) * ((h+3) >> 2) * 8)
+    return gct_ERR_INVALID_IMAGE;
+
+  *width = (int)w;
+  *height = (int)h;
+  *blocks = p + offset;
+  return gct_SUCCESS;
+}
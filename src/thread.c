@@ -0,0 +1,456 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Internal threading resources
+ *
+ ******************************************************************************/
+
+// Needed for sysconf with strict C99
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gct/gctlib.h"
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#endif
+
+// Arguments passed to each started thread
+typedef struct thread_arg_s {
+  thread_func_t func;
+  void *arg;
+  int index;
+} thread_arg_t;
+
+#ifdef _WIN32
+static unsigned __stdcall ThreadEntry(void *arg) {
+  const thread_arg_t * const t = (thread_arg_t*)arg;
+
+  t->func(t->arg, t->index);
+  return 0;
+}
+
+static gct_b32 StartThread(thread_t *thread, thread_arg_t *arg) {
+  *thread = (HANDLE)_beginthreadex(NULL, 0, ThreadEntry, arg, 0, NULL);
+  return *thread != NULL;
+}
+
+static void JoinThread(thread_t thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+static void InitMutex(mutex_t *mutex) {
+  InitializeCriticalSection(mutex);
+}
+
+static void DestroyMutex(mutex_t *mutex) {
+  DeleteCriticalSection(mutex);
+}
+
+static void LockMutex(mutex_t *mutex) {
+  EnterCriticalSection(mutex);
+}
+
+static void UnlockMutex(mutex_t *mutex) {
+  LeaveCriticalSection(mutex);
+}
+
+static void InitCond(cond_t *cond) {
+  InitializeConditionVariable(cond);
+}
+
+static void DestroyCond(cond_t *cond) {
+  (void)cond;
+}
+
+static void WaitCond(cond_t *cond, mutex_t *mutex) {
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+static void WakeCond(cond_t *cond) {
+  WakeAllConditionVariable(cond);
+}
+
+int GetCPUCount(void) {
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+#else
+static void *ThreadEntry(void *arg) {
+  const thread_arg_t * const t = (thread_arg_t*)arg;
+
+  t->func(t->arg, t->index);
+  return NULL;
+}
+
+static gct_b32 StartThread(thread_t *thread, thread_arg_t *arg) {
+  return pthread_create(thread, NULL, ThreadEntry, arg) == 0;
+}
+
+static void JoinThread(thread_t thread) {
+  pthread_join(thread, NULL);
+}
+
+static void InitMutex(mutex_t *mutex) {
+  pthread_mutex_init(mutex, NULL);
+}
+
+static void DestroyMutex(mutex_t *mutex) {
+  pthread_mutex_destroy(mutex);
+}
+
+static void LockMutex(mutex_t *mutex) {
+  pthread_mutex_lock(mutex);
+}
+
+static void UnlockMutex(mutex_t *mutex) {
+  pthread_mutex_unlock(mutex);
+}
+
+static void InitCond(cond_t *cond) {
+  pthread_cond_init(cond, NULL);
+}
+
+static void DestroyCond(cond_t *cond) {
+  pthread_cond_destroy(cond);
+}
+
+static void WaitCond(cond_t *cond, mutex_t *mutex) {
+  pthread_cond_wait(cond, mutex);
+}
+
+static void WakeCond(cond_t *cond) {
+  pthread_cond_broadcast(cond);
+}
+
+int GetCPUCount(void) {
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+#endif
+
+void RunThreads(int count, thread_func_t func, void *arg) {
+  thread_t *threads;
+  thread_arg_t *args;
+  gct_b8 *started;
+  int i;
+
+  if (count < 2) {
+    if (count == 1) func(arg, 0);
+    return;
+  }
+
+  // Run everything on this thread if we can't allocate thread data
+  threads = (thread_t*)malloc(sizeof(thread_t) * count);
+  args = (thread_arg_t*)malloc(sizeof(thread_arg_t) * count);
+  started = (gct_b8*)malloc(count);
+  if (!threads || !args || !started) {
+    free(threads);
+    free(args);
+    free(started);
+
+    for (i = 0; i < count; ++i) func(arg, i);
+    return;
+  }
+
+  for (i = 1; i < count; ++i) {
+    args[i].func = func;
+    args[i].arg = arg;
+    args[i].index = i;
+    started[i] = StartThread(threads+i, args+i);
+  }
+
+  func(arg, 0);
+
+  for (i = 1; i < count; ++i) {
+    if (started[i]) JoinThread(threads[i]);
+    else func(arg, i);
+  }
+
+  free(threads);
+  free(args);
+  free(started);
+}
+
+// Range of task indices [next, end) left to a pool thread, the
+// thread takes tasks from the front, and idle threads steal from
+// the back
+typedef struct pool_range_s {
+  mutex_t lock;
+  int next, end;
+} pool_range_t;
+
+struct gct_thread_pool_s {
+  // Started threads, the thread calling RunPool is always index 0
+  int numThreads;
+  thread_t *threads;
+  thread_arg_t *args;
+
+  // Tasks left to each thread
+  pool_range_t *ranges;
+
+  // Held by RunPool, so only one batch of tasks runs at a time
+  mutex_t runLock;
+
+  // Guards everything below, wake is signaled when a batch of tasks
+  // starts or the pool is destroyed, done when a thread runs out of tasks
+  mutex_t lock;
+  cond_t wake, done;
+
+  // Function run for each task of the current batch
+  thread_func_t func;
+  void *arg;
+
+  // Incremented for every batch, so threads know when to start
+  gct_u32 batch;
+
+  // Started threads still running tasks of the current batch
+  int active;
+
+  gct_b32 quit;
+};
+
+// Take the next task of a thread, stealing the back half of the
+// biggest range if it has none left. Returns -1 once every task is taken
+static int NextTask(gct_thread_pool_t *pool, int index) {
+  pool_range_t * const range = pool->ranges + index;
+  pool_range_t *victim;
+  int i, task = -1, left, most, mid, end = 0;
+
+  LockMutex(&range->lock);
+  if (range->next < range->end) task = range->next++;
+  UnlockMutex(&range->lock);
+  if (task >= 0) return task;
+
+  for (;;) {
+    // Tasks are never added, so once every range
+    // looks empty there's nothing left to steal
+    victim = NULL;
+    most = 0;
+    for (i = 0; i < pool->numThreads; ++i) {
+      if (i == index) continue;
+
+      LockMutex(&pool->ranges[i].lock);
+      left = pool->ranges[i].end - pool->ranges[i].next;
+      UnlockMutex(&pool->ranges[i].lock);
+
+      if (left > most) {
+        most = left;
+        victim = pool->ranges + i;
+      }
+    }
+    if (!victim) return -1;
+
+    LockMutex(&victim->lock);
+    left = victim->end - victim->next;
+    if (left > 0) {
+      mid = victim->next + (left >> 1);
+      end = victim->end;
+      victim->end = mid;
+      task = mid;
+    }
+    UnlockMutex(&victim->lock);
+
+    if (task >= 0) break;
+  }
+
+  LockMutex(&range->lock);
+  range->next = task+1;
+  range->end = end;
+  UnlockMutex(&range->lock);
+
+  return task;
+}
+
+// Run tasks of the current batch until there are none left
+static void RunTasks(gct_thread_pool_t *pool, int index) {
+  int task;
+
+  while ((task = NextTask(pool, index)) >= 0)
+    pool->func(pool->arg, task);
+}
+
+// Loop run by every started pool thread
+static void PoolThread(void *arg, int index) {
+  gct_thread_pool_t * const pool = (gct_thread_pool_t*)arg;
+  gct_u32 batch = 0;
+  gct_b32 quit;
+
+  for (;;) {
+    LockMutex(&pool->lock);
+    while (!pool->quit && pool->batch == batch)
+      WaitCond(&pool->wake, &pool->lock);
+    batch = pool->batch;
+    quit = pool->quit;
+    UnlockMutex(&pool->lock);
+
+    if (quit) return;
+
+    RunTasks(pool, index);
+
+    LockMutex(&pool->lock);
+    if (!--pool->active) WakeCond(&pool->done);
+    UnlockMutex(&pool->lock);
+  }
+}
+
+// Destroy pool, stopping every thread that was started
+static void DestroyPool(gct_thread_pool_t *pool) {
+  int i;
+
+  LockMutex(&pool->lock);
+  pool->quit = gct_true;
+  WakeCond(&pool->wake);
+  UnlockMutex(&pool->lock);
+
+  for (i = 1; i < pool->numThreads; ++i)
+    JoinThread(pool->threads[i]);
+
+  for (i = 0; i < pool->numThreads; ++i)
+    DestroyMutex(&pool->ranges[i].lock);
+  DestroyMutex(&pool->runLock);
+  DestroyMutex(&pool->lock);
+  DestroyCond(&pool->wake);
+  DestroyCond(&pool->done);
+
+  free(pool->threads);
+  free(pool->args);
+  free(pool->ranges);
+  free(pool);
+}
+
+gct_error_t gct_CreateThreadPool(gct_thread_pool_t **pool, int numThreads) {
+  gct_thread_pool_t *p;
+  int i;
+
+  if (!pool) return gct_ERR_NULL_POINTER;
+  if (numThreads <= 0) numThreads = GetCPUCount();
+
+  p = (gct_thread_pool_t*)malloc(sizeof(gct_thread_pool_t));
+  if (!p) return gct_ERR_OUT_OF_MEMORY;
+
+  p->threads = (thread_t*)malloc(sizeof(thread_t) * numThreads);
+  p->args = (thread_arg_t*)malloc(sizeof(thread_arg_t) * numThreads);
+  p->ranges = (pool_range_t*)malloc(sizeof(pool_range_t) * numThreads);
+  if (!p->threads || !p->args || !p->ranges) {
+    free(p->threads);
+    free(p->args);
+    free(p->ranges);
+    free(p);
+    return gct_ERR_OUT_OF_MEMORY;
+  }
+
+  for (i = 0; i < numThreads; ++i) {
+    InitMutex(&p->ranges[i].lock);
+    p->ranges[i].next = p->ranges[i].end = 0;
+  }
+  InitMutex(&p->runLock);
+  InitMutex(&p->lock);
+  InitCond(&p->wake);
+  InitCond(&p->done);
+
+  p->batch = 0;
+  p->active = 0;
+  p->quit = gct_false;
+
+  // The pool just ends up smaller if a thread can't be started
+  p->numThreads = 1;
+  for (i = 1; i < numThreads; ++i) {
+    p->args[i].func = PoolThread;
+    p->args[i].arg = p;
+    p->args[i].index = i;
+    if (!StartThread(p->threads+i, p->args+i)) break;
+
+    p->numThreads = i+1;
+  }
+
+  *pool = p;
+  return gct_SUCCESS;
+}
+
+void gct_DestroyThreadPool(gct_thread_pool_t *pool) {
+  if (pool) DestroyPool(pool);
+}
+
+int GetPoolSize(const gct_thread_pool_t *pool) {
+  return pool->numThreads;
+}
+
+void RunPool(gct_thread_pool_t *pool, int count,
+             thread_func_t func, void *arg)
+{
+  int i;
+
+  if (count <= 0) return;
+
+  LockMutex(&pool->runLock);
+
+  // Split tasks evenly, threads steal from each other once they run out
+  for (i = 0; i < pool->numThreads; ++i) {
+    pool->ranges[i].next = (int)((gct_iptr)count*i / pool->numThreads);
+    pool->ranges[i].end = (int)((gct_iptr)count*(i+1) / pool->numThreads);
+  }
+
+  LockMutex(&pool->lock);
+  pool->func = func;
+  pool->arg = arg;
+  pool->active = pool->numThreads-1;
+  ++pool->batch;
+  WakeCond(&pool->wake);
+  UnlockMutex(&pool->lock);
+
+  RunTasks(pool, 0);
+
+  LockMutex(&pool->lock);
+  while (pool->active) WaitCond(&pool->done, &pool->lock);
+  UnlockMutex(&pool->lock);
+
+  UnlockMutex(&pool->runLock);
+}
+
+struct lock_s {
+  mutex_t mutex;
+};
+
+lock_t *CreateLock(void) {
+  lock_t * const lock = (lock_t*)malloc(sizeof(lock_t));
+
+  if (lock) InitMutex(&lock->mutex);
+  return lock;
+}
+
+void DestroyLock(lock_t *lock) {
+  DestroyMutex(&lock->mutex);
+  free(lock);
+}
+
+void AcquireLock(lock_t *lock) {
+  LockMutex(&lock->mutex);
+}
+
+void ReleaseLock(lock_t *lock) {
+  UnlockMutex(&lock->mutex);
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  Internal threading resources
+ *
+ ******************************************************************************/
+
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#include "gct/gctlib.h"
+
+// Function run by every thread in RunThreads,
+// index is in the range [0, count)
+typedef void (*thread_func_t)(void *arg, int index);
+
+// Get number of logical processors, always returns at least 1
+int GetCPUCount(void);
+
+// Run func count times in parallel, once per index,
+// and wait for every call to return
+//
+// Index 0 is always run on the calling thread, if a thread can't
+// be started its index is run on the calling thread instead
+void RunThreads(int count, thread_func_t func, void *arg);
+
+// Get number of threads in pool, including the thread calling RunPool
+int GetPoolSize(const gct_thread_pool_t *pool);
+
+// Run func count times on the threads of pool, once per index,
+// and wait for every call to return
+//
+// Indices are split evenly between the threads, threads that run out
+// steal half of what's left to another thread. The calling thread
+// runs tasks too. Calls from different threads run one after another
+void RunPool(gct_thread_pool_t *pool, int count,
+             thread_func_t func, void *arg);
+
+// Mutex for other parts of the library, so they don't
+// need to know about the threading API
+typedef struct lock_s lock_t;
+
+// Create unlocked mutex, returns NULL if it couldn't be allocated
+lock_t *CreateLock(void);
+
+// Destroy mutex, it must be unlocked
+void DestroyLock(lock_t *lock);
+
+void AcquireLock(lock_t *lock);
+void ReleaseLock(lock_t *lock);
+
+#endif //_THREAD_H
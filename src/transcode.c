@@ -0,0 +1,497 @@
+/******************************************************************************
+ *
+ * Copyright(c) 2022 Lian Ferrand
+ * This file is part of GCTlib
+ *
+ * File description:
+ *  CMPR to BC1/BC3 transcoder
+ *  CMPR blocks are DXT1 blocks with big-endian endpoints, the first pixel
+ *  in the top bits of each index byte, and 4 blocks to each 8x8
+ *  supertile, so color blocks only have to be shuffled around
+ *
+ ******************************************************************************/
+
+#include "gct/gctlib.h"
+#include "common.h"
+#include "cmpr.h"
+
+#include <stdlib.h>
+
+// Alpha blocks are matched to BC4 endpoints once for every combination
+// of 3-color mode, both 6-bit endpoints and the indices that are used
+#define ALPHA_FIT_COUNT (2*64*64*16)
+
+// Bits of a cached alpha fit, endpoints are in the low 16 bits
+// and the BC4 index for each CMPR index is above them
+#define ALPHA_FIT_VALID   0x80000000
+#define ALPHA_FIT_INEXACT 0x40000000
+
+// Transcoder state
+typedef struct transcoder_s {
+  const gct_u8 *color, *alpha;
+  gct_i32 width, height;
+  gct_block_format_t format;
+
+  // Rows are stored bottom-up
+  gct_b32 flipped;
+
+  // Cached alpha fits for BC3, indexed by AlphaFitKey. Only allocated
+  // once a block with more than one level needs to be fitted
+  gct_u32 *alphaFits;
+
+  // Blocks that couldn't be represented exactly
+  gct_uptr lossyBlocks;
+} transcoder_t;
+
+gct_iptr gct_TranscodedSize(const void *file, gct_block_format_t format) {
+  gct_i32 width, height;
+  gct_error_t err;
+
+  if (!file) return -gct_ERR_NULL_POINTER;
+
+  err = ReadImageHeader((const gct_header_t*)file, &width, &height);
+  if (err) return -err;
+
+  switch (format) {
+  case gct_BLOCK_BC1:
+    return (gct_iptr)width*height / 2;
+  case gct_BLOCK_BC3:
+    return (gct_iptr)width*height;
+  default:
+    return -gct_ERR_UNSUPPORTED_FORMAT;
+  }
+}
+
+// Get the indices used by a CMPR block as a bit mask
+static int UsedIndices(const gct_u8 *src) {
+  int used = 0, i;
+
+  for (i = 4; i < 8; ++i) {
+    used |= 1 << (src[i] >> 6);
+    used |= 1 << ((src[i] >> 4) & 3);
+    used |= 1 << ((src[i] >> 2) & 3);
+    used |= 1 << (src[i] & 3);
+  }
+
+  return used;
+}
+
+// Convert CMPR block to a BC1 block, endpoints become little endian
+// and the first pixel of each row moves to the low bits
+static void WriteBC1(gct_u8 *dest, const gct_u8 *src) {
+  dest[0] = src[1];
+  dest[1] = src[0];
+  dest[2] = src[3];
+  dest[3] = src[2];
+  dest[4] = ReverseIndices[src[4]];
+  dest[5] = ReverseIndices[src[5]];
+  dest[6] = ReverseIndices[src[6]];
+  dest[7] = ReverseIndices[src[7]];
+}
+
+// Expand 5 and 6-bit channels to 8 bits, same as the decoder
+#define EXPAND5(_c) (((_c) << 3) | ((_c) >> 2))
+#define EXPAND6(_c) (((_c) << 2) | ((_c) >> 4))
+
+// Write color half of a BC3 block. BC3 color blocks always use
+// 4-color mode, so blocks in 3-color mode (first endpoint not above
+// the second) are only copied when they don't use the midpoint or
+// black. Anything else is rewritten with two of its colors as the
+// endpoints if it can be, or compressed again from its own palette.
+// Returns gct_false if the block doesn't decode to the same pixels
+static gct_b32 WriteBC3Color(gct_u8 *dest, const gct_u8 *src) {
+  const int c0 = (src[0] << 8) | src[1];
+  const int c1 = (src[2] << 8) | src[3];
+  const int used = UsedIndices(src);
+  const int ends[4] = {c0, c1, -1, 0};
+  gct_color_t pal[4], block[16];
+  gct_u8 tmp[8], codes[4];
+  int i, hi = -1, lo = 0xffff;
+
+  if (c0 > c1 ||
+      ((!(used & 4) || c0 == c1) && (!(used & 8) || !(c0|c1)))) {
+    WriteBC1(dest, src);
+    return gct_true;
+  }
+
+  // Without the midpoint every color is an endpoint or black, so two
+  // different colors (often one color and black) become the endpoints
+  if (!(used & 4)) {
+    for (i = 0; i < 4; ++i) {
+      if (!(used & (1 << i))) continue;
+      if (ends[i] > hi) hi = ends[i];
+      if (ends[i] < lo) lo = ends[i];
+    }
+
+    for (i = 0; i < 4; ++i) {
+      if ((used & (1 << i)) && ends[i] != hi && ends[i] != lo) break;
+      codes[i] = (gct_u8)(ends[i] == hi ? 0 : 1);
+    }
+
+    if (i == 4) {
+      tmp[0] = (gct_u8)(hi >> 8);
+      tmp[1] = (gct_u8)(hi & 0xff);
+      tmp[2] = (gct_u8)(lo >> 8);
+      tmp[3] = (gct_u8)(lo & 0xff);
+      for (i = 4; i < 8; ++i) {
+        tmp[i] = (gct_u8)((codes[src[i] >> 6] << 6) |
+                          (codes[(src[i] >> 4) & 3] << 4) |
+                          (codes[(src[i] >> 2) & 3] << 2) |
+                          codes[src[i] & 3]);
+      }
+
+      WriteBC1(dest, tmp);
+      return gct_true;
+    }
+  }
+
+  for (i = 0; i < 2; ++i) {
+    const int c = i ? c1 : c0;
+    pal[i].r = (gct_u8)EXPAND5(c >> 11);
+    pal[i].g = (gct_u8)EXPAND6((c >> 5) & 0x3f);
+    pal[i].b = (gct_u8)EXPAND5(c & 0x1f);
+    pal[i].a = 255;
+  }
+  pal[2].r = (gct_u8)((pal[0].r + pal[1].r) / 2);
+  pal[2].g = (gct_u8)((pal[0].g + pal[1].g) / 2);
+  pal[2].b = (gct_u8)((pal[0].b + pal[1].b) / 2);
+  pal[2].a = 255;
+  pal[3].r = pal[3].g = pal[3].b = 0;
+  pal[3].a = 255;
+
+  for (i = 0; i < 16; ++i)
+    block[i] = pal[(src[4 + (i >> 2)] >> (6 - (i&3)*2)) & 3];
+
+  for (i = 1; i < 16; ++i) {
+    if (block[i].r != block[0].r || block[i].g != block[0].g ||
+        block[i].b != block[0].b)
+      break;
+  }
+
+  if (i == 16)
+    CompressConstantColor(tmp, block[0].r, block[0].g, block[0].b);
+  else
+    CompressColorBlock(GetCMPRKernels(), tmp, block, gct_QUALITY_HIGH);
+
+  // Compressed block is only lossy if it decodes to something else,
+  // the error is measured the way 4-color mode decodes it
+  WriteBC1(dest, tmp);
+  return !ColorBlockError(tmp, block);
+}
+
+// Get index of alpha block in the fit cache
+static int AlphaFitKey(const gct_u8 *src, int used) {
+  const int c0 = (src[0] << 8) | src[1];
+  const int c1 = (src[2] << 8) | src[3];
+
+  return ((c0 <= c1) << 16) | (((c0 >> 5) & 0x3f) << 10) |
+    (((c1 >> 5) & 0x3f) << 4) | used;
+}
+
+// Get the 4 alpha levels of a CMPR alpha block as the decoder sees them,
+// from the 3-color mode bit and the green channel of each endpoint
+static void AlphaLevels(int key, int *lv) {
+  const int g0 = (key >> 10) & 0x3f;
+  const int g1 = (key >> 4) & 0x3f;
+
+  lv[0] = EXPAND6(g0);
+  lv[1] = EXPAND6(g1);
+  if (key & 0x10000) {
+    // Midpoint and black
+    lv[2] = (lv[0] + lv[1]) / 2;
+    lv[3] = 0;
+  } else {
+    lv[2] = (lv[0]*2 + lv[1]) / 3;
+    lv[3] = (lv[0] + lv[1]*2) / 3;
+  }
+}
+
+// Match used alpha levels to the closest entries of a BC4 palette
+// with endpoints a0 and a1, and get the BC4 index of each level.
+// Palette entries are compared times 35 so interpolated entries of
+// both modes are exact, an error of 0 means every decoder gets the
+// level right no matter how it rounds
+static int MatchBC4(int a0, int a1, const int *lv, int used,
+                    int *codes, int *sumErr)
+{
+  int pal[8], maxErr = 0, i, j;
+
+  pal[0] = a0*35;
+  pal[1] = a1*35;
+  if (a0 > a1) {
+    // 6 interpolated entries
+    for (i = 1; i < 7; ++i)
+      pal[i+1] = ((7-i)*a0 + i*a1) * 5;
+  } else {
+    // 4 interpolated entries, 0 and 255
+    for (i = 1; i < 5; ++i)
+      pal[i+1] = ((5-i)*a0 + i*a1) * 7;
+    pal[6] = 0;
+    pal[7] = 255*35;
+  }
+
+  *sumErr = 0;
+  for (i = 0; i < 4; ++i) {
+    int best = 0, bestErr = 255*35 + 1;
+
+    if (!(used & (1 << i))) continue;
+
+    for (j = 0; j < 8; ++j) {
+      const int err = abs(lv[i]*35 - pal[j]);
+
+      if (err < bestErr) {
+        bestErr = err;
+        best = j;
+      }
+    }
+
+    codes[i] = best;
+    *sumErr += bestErr;
+    if (bestErr > maxErr) maxErr = bestErr;
+  }
+
+  return maxErr;
+}
+
+// Floor division that rounds towards negative infinity
+static int FloorDiv(int a, int b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Best BC4 endpoints found so far for an alpha block
+typedef struct alpha_fit_s {
+  int a0, a1, maxErr, sumErr;
+  int codes[4];
+} alpha_fit_t;
+
+// Try BC4 endpoints for the used levels, and keep them if they're better
+static void TryAlphaFit(alpha_fit_t *fit, int a0, int a1,
+                        const int *lv, int used)
+{
+  int codes[4] = {0, 0, 0, 0}, maxErr, sumErr;
+
+  // Endpoints past the ends of the range are pulled back in,
+  // which can still be closer than anything else
+  a0 = a0 < 0 ? 0 : a0 > 255 ? 255 : a0;
+  a1 = a1 < 0 ? 0 : a1 > 255 ? 255 : a1;
+
+  maxErr = MatchBC4(a0, a1, lv, used, codes, &sumErr);
+  if (maxErr < fit->maxErr ||
+      (maxErr == fit->maxErr && sumErr < fit->sumErr)) {
+    fit->a0 = a0;
+    fit->a1 = a1;
+    fit->maxErr = maxErr;
+    fit->sumErr = sumErr;
+    fit->codes[0] = codes[0];
+    fit->codes[1] = codes[1];
+    fit->codes[2] = codes[2];
+    fit->codes[3] = codes[3];
+  }
+}
+
+// Find BC4 endpoints for the used levels of a CMPR alpha block
+//
+// Levels are a third of the way between the endpoints, which neither BC4
+// mode has, so endpoints are picked further apart: for each pair of levels
+// and each pair of palette positions, the line through them gives a pair
+// of endpoints. Blocks with up to two levels are always exact, blocks
+// with more are exact when their levels line up with a BC4 palette,
+// the closest endpoints are kept otherwise
+static gct_u32 FitAlphaBlock(int key) {
+  const int used = key & 15;
+  alpha_fit_t fit;
+  int lv[4], n, i, j, pi, pj, a0, a1, r;
+
+  AlphaLevels(key, lv);
+  fit.a0 = fit.a1 = fit.sumErr = 0;
+  fit.maxErr = 0x7fffffff;
+  fit.codes[0] = fit.codes[1] = fit.codes[2] = fit.codes[3] = 0;
+
+  // Blocks of a single level are both endpoints
+  for (i = 0; i < 4 && fit.maxErr; ++i) {
+    if (used & (1 << i)) TryAlphaFit(&fit, lv[i], lv[i], lv, used);
+  }
+
+  for (n = 7; n >= 5 && fit.maxErr; n -= 2) {
+    for (i = 0; i < 4; ++i) {
+      if (!(used & (1 << i))) continue;
+
+      for (j = i+1; j < 4; ++j) {
+        if (!(used & (1 << j)) || lv[i] == lv[j]) continue;
+
+        for (pi = 0; pi < n && fit.maxErr; ++pi) {
+          for (pj = pi+1; pj <= n && fit.maxErr; ++pj) {
+            // Endpoints that put level i at position pi of the
+            // palette and level j at position pj, rounded both ways
+            a0 = FloorDiv(lv[i]*pj - lv[j]*pi, pj-pi);
+            a1 = FloorDiv(lv[i]*(pj-n) + lv[j]*(n-pi), pj-pi);
+
+            for (r = 0; r < 4 && fit.maxErr; ++r) {
+              // First endpoint is above the second for 6 interpolated
+              // entries, the palette is the same either way around
+              if ((n == 7) == (a0 + (r&1) > a1 + (r>>1)))
+                TryAlphaFit(&fit, a0 + (r&1), a1 + (r>>1), lv, used);
+              else
+                TryAlphaFit(&fit, a1 + (r>>1), a0 + (r&1), lv, used);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Levels spread too far apart for either mode can be off by several
+  // steps, every pair of endpoints is tried for the few blocks like that
+  if (fit.maxErr > 35) {
+    for (a0 = 0; a0 < 256; ++a0) {
+      for (a1 = 0; a1 < 256; ++a1)
+        TryAlphaFit(&fit, a0, a1, lv, used);
+    }
+  }
+
+  return ALPHA_FIT_VALID | (fit.maxErr ? ALPHA_FIT_INEXACT : 0) |
+    ((gct_u32)fit.codes[0] << 16) | ((gct_u32)fit.codes[1] << 19) |
+    ((gct_u32)fit.codes[2] << 22) | ((gct_u32)fit.codes[3] << 25) |
+    ((gct_u32)fit.a1 << 8) | (gct_u32)fit.a0;
+}
+
+// Check if every index an alpha block uses has the same level
+static gct_b32 SingleAlphaLevel(int key) {
+  const int used = key & 15;
+  int lv[4], i, level = -1;
+
+  AlphaLevels(key, lv);
+  for (i = 0; i < 4; ++i) {
+    if (!(used & (1 << i))) continue;
+    if (level >= 0 && lv[i] != level) return gct_false;
+    level = lv[i];
+  }
+
+  return gct_true;
+}
+
+// Get the BC4 fit of a CMPR alpha block. Blocks of a single level,
+// like fully opaque ones, are fitted right away without the cache
+static gct_error_t GetAlphaFit(transcoder_t *tc, const gct_u8 *src,
+                               gct_u32 *fit)
+{
+  const int key = AlphaFitKey(src, UsedIndices(src));
+
+  if (SingleAlphaLevel(key)) {
+    *fit = FitAlphaBlock(key);
+    return gct_SUCCESS;
+  }
+
+  if (!tc->alphaFits) {
+    tc->alphaFits = (gct_u32*)calloc(ALPHA_FIT_COUNT, sizeof(gct_u32));
+    if (!tc->alphaFits) return gct_ERR_OUT_OF_MEMORY;
+  }
+
+  *fit = tc->alphaFits[key];
+  if (!*fit) *fit = tc->alphaFits[key] = FitAlphaBlock(key);
+  return gct_SUCCESS;
+}
+
+// Write alpha half of a BC3 block from a CMPR alpha block and its fit,
+// the first pixel is in the low bits of the 48-bit index table
+static gct_b32 WriteBC3Alpha(gct_u8 *dest, const gct_u8 *src, gct_u32 fit) {
+  gct_u32 lo = 0, hi = 0;
+  int i;
+
+  for (i = 0; i < 16; ++i) {
+    const int index = (src[4 + (i >> 2)] >> (6 - (i&3)*2)) & 3;
+    const gct_u32 code = (fit >> (16 + index*3)) & 7;
+
+    if (i < 8) lo |= code << (i*3);
+    else hi |= code << ((i-8)*3);
+  }
+
+  dest[0] = fit & 0xff;
+  dest[1] = (fit >> 8) & 0xff;
+  dest[2] = lo & 0xff;
+  dest[3] = (lo >> 8) & 0xff;
+  dest[4] = (lo >> 16) & 0xff;
+  dest[5] = hi & 0xff;
+  dest[6] = (hi >> 8) & 0xff;
+  dest[7] = (hi >> 16) & 0xff;
+
+  return !(fit & ALPHA_FIT_INEXACT);
+}
+
+// Transcode every block of the image into linear block order,
+// top row first even when rows are stored bottom-up
+static gct_error_t TranscodeBlocks(transcoder_t *tc, gct_u8 *output) {
+  const gct_i32 blocksWide = tc->width >> 2;
+  const gct_i32 blocksHigh = tc->height >> 2;
+  const gct_iptr blockSize = tc->format == gct_BLOCK_BC3 ? 16 : 8;
+  const gct_u8 *color, *alpha;
+  gct_u8 flippedColor[8], flippedAlpha[8];
+  gct_i32 bx, by, sy;
+  gct_u32 fit;
+  gct_error_t err;
+
+  for (by = 0; by < blocksHigh; ++by) {
+    sy = tc->flipped ? blocksHigh - 1 - by : by;
+
+    for (bx = 0; bx < blocksWide; ++bx) {
+      // Blocks of a supertile are top left, top right,
+      // bottom left, then bottom right
+      const gct_iptr offset = ((gct_iptr)(sy >> 1)*(blocksWide >> 1) +
+                               (bx >> 1))*32 + ((sy & 1)*2 + (bx & 1))*8;
+      gct_u8 * const dest = output + ((gct_iptr)by*blocksWide + bx)*blockSize;
+
+      color = tc->color + offset;
+      alpha = tc->alpha + offset;
+      if (tc->flipped) {
+        FlipBlock(flippedColor, color);
+        FlipBlock(flippedAlpha, alpha);
+        color = flippedColor;
+        alpha = flippedAlpha;
+      }
+
+      if (tc->format == gct_BLOCK_BC1) {
+        WriteBC1(dest, color);
+        continue;
+      }
+
+      err = GetAlphaFit(tc, alpha, &fit);
+      if (err) return err;
+
+      if (!WriteBC3Alpha(dest, alpha, fit) || !WriteBC3Color(dest+8, color))
+        ++tc->lossyBlocks;
+    }
+  }
+
+  return gct_SUCCESS;
+}
+
+gct_error_t gct_Transcode(const void *file, gct_block_format_t format,
+                          void *output, gct_uptr *lossyBlocks)
+{
+  const gct_header_t * const hdr = (gct_header_t*)file;
+  transcoder_t tc;
+  gct_error_t err;
+
+  if (!file || !output)
+    return gct_ERR_NULL_POINTER;
+  else if (format != gct_BLOCK_BC1 && format != gct_BLOCK_BC3)
+    return gct_ERR_UNSUPPORTED_FORMAT;
+
+  err = ReadImageHeader(hdr, &tc.width, &tc.height);
+  if (err) return err;
+
+  tc.color = (const gct_u8*)(hdr+1);
+  tc.alpha = tc.color + ((tc.width*tc.height) >> 1);
+  tc.format = format;
+  tc.flipped = ImageFlipped(hdr);
+  tc.alphaFits = NULL;
+  tc.lossyBlocks = 0;
+
+  err = TranscodeBlocks(&tc, (gct_u8*)output);
+
+  free(tc.alphaFits);
+  if (err) return err;
+
+  if (lossyBlocks) *lossyBlocks = tc.lossyBlocks;
+  return gct_SUCCESS;
+}